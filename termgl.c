@@ -8,6 +8,7 @@
 
 #include "termgl.h"
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -33,8 +34,6 @@
 #endif
 
 #ifdef TGL_OS_WINDOWS
-#include <errno.h>
-
 #define WINDOWS_CALL(cond, retval)                                                                 \
 	do {                                                                                       \
 		if (TGL_UNLIKELY(cond)) {                                                          \
@@ -44,25 +43,93 @@
 	} while (0)
 #endif
 
-typedef struct Pixel {
-	char v_char;
-	TGLPixFmt color;
-} Pixel;
-
 struct TGL {
 	unsigned width;
 	unsigned height;
 	int max_x;
 	int max_y;
+	int scissor_x0;
+	int scissor_y0;
+	int scissor_x1;
+	int scissor_y1;
 	unsigned frame_size;
-	Pixel *frame_buffer;
+	TGLPixel *frame_buffer;
 	float *z_buffer;
+	float *hiz_buffer; /* farthest depth of each tile */
+	bool *hiz_dirty; /* tile must be recomputed from z_buffer */
+	unsigned hiz_width;
+	unsigned hiz_height;
 	char *output_buffer;
 	unsigned output_buffer_size;
+	TGLLayer **layers;
+	unsigned n_layers;
+	unsigned layers_capacity;
+#ifdef TERMGL3D
+	TGLVec4 *vert_cache; /* clip space vertices of the last drawn mesh */
+	unsigned vert_cache_capacity;
+	TGLVec3 *vert_gather; /* object space vertices of the last drawn mesh used by front faces */
+	unsigned vert_gather_capacity;
+	unsigned *vert_remap; /* index of each vertex of the last drawn mesh in vert_cache */
+	unsigned vert_remap_capacity;
+	unsigned *tri_visible; /* front faces of the last drawn mesh */
+	unsigned tri_visible_capacity;
+	TGLVec4 cull_eye; /* homogeneous eye position in object space */
+	bool cull_eye_enabled;
+	TGLPrimitiveShader *prim_shader;
+	const void *prim_data;
+	float *vert_varyings; /* varyings of each vertex in vert_cache */
+	unsigned vert_varyings_capacity;
+#ifndef TERMGL_MINIMAL
+	const TGLLighting *lighting;
+	const TGLTexture *texture;
+	uint8_t *vert_light; /* light intensity of each vertex in vert_cache */
+	unsigned vert_light_capacity;
+#endif
+#endif
 	bool z_buffer_enabled;
-	uint8_t settings;
+	uint16_t settings;
+};
+
+#ifndef TERMGL_MINIMAL
+struct TGLAtlas {
+	unsigned width;
+	unsigned height;
+	TGLPixFmt palette[256];
+	TGLTexel *texels;
 };
 
+/* Texture being placed into an atlas */
+typedef struct AtlasItem {
+	unsigned idx;
+	unsigned height;
+	unsigned x;
+	unsigned y;
+} AtlasItem;
+#endif /* ~TERMGL_MINIMAL */
+
+#define SPAN_BATCH_SIZE 64
+
+/* Pixels of a row which passed the depth test, shaded together by a TGLSpanShader */
+typedef struct SpanBatch {
+	const TGLPixelShaderSpan *span;
+	unsigned count;
+	int x[SPAN_BATCH_SIZE];
+	uint8_t uv[SPAN_BATCH_SIZE][2];
+} SpanBatch;
+
+#ifdef TERMGL3D
+/* Triangle whose vertices have varyings, interpolated across the spans filled by fill_triangle */
+typedef struct VaryingsRaster {
+	float x0, y0; /* screen space position of the first vertex */
+	const float *attrs; /* depth, 1 / w, and varyings divided by w of the first vertex */
+	const float *ddx, *ddy; /* screen space gradients of the attributes */
+	float inv_w_min, inv_w_max;
+	unsigned n_varyings;
+	TGLPixelShaderVaryings *frag_shader;
+	const void *frag_data;
+} VaryingsRaster;
+#endif
+
 #define SWAP(typ, a, b)                                                                            \
 	do {                                                                                       \
 		typ __swap_temp = (a);                                                             \
@@ -81,37 +148,100 @@ struct TGL {
 #define CALL_STDOUT(stmt, retval) CALL((stmt) == EOF, retval)
 
 #define MIX(begin, end, d) ((begin) * (d) + (end) * (1 - (d)))
+#define ROUND(f) ((int)((f) < 0 ? (f) - .5f : (f) + .5f))
+
+/* Hierarchical depth buffer tile size: 8x4 characters, roughly square on most terminals */
+#define HIZ_SHIFT_X 3
+#define HIZ_SHIFT_Y 2
+#define HIZ_MASK_X ((1 << HIZ_SHIFT_X) - 1)
 
 #ifndef TERMGL_MINIMAL
 const TGLGradient tgl_gradient_full = {
 	.length = 70,
 	.grad = " .'`^\",:;Il!i><~+_-?][}{1)(|\\/tfjrxnuvczXYUJCLQ0OZmwqpdbkhao*#MW&8%B@$",
+	.lut = "    ....'''````^^^^\"\"\",,,,::::;;;IIIIllll!!!iiii>>>><<<~~~~++++_"
+	       "__----????]]][[[[}}}}{{{1111))))(((||||\\\\\\\\///ttttffffjjjrrrrxxx"
+	       "nnnnuuuuvvvcccczzzzXXXYYYYUUUUJJJCCCCLLLLQQQ0000OOOOZZZmmmmwwwwq"
+	       "qqppppddddbbbkkkkhhhhaaaoooo****###MMMMWWWW&&&8888%%%%BBB@@@@$$$",
 };
 
 const TGLGradient tgl_gradient_min = {
 	.length = 10,
 	.grad = " .:-=+*#%@",
+	.lut = "                          ..........................::::::::::::"
+	       ":::::::::::::--------------------------========================="
+	       "++++++++++++++++++++++++++**************************############"
+	       "#############%%%%%%%%%%%%%%%%%%%%%%%%%%@@@@@@@@@@@@@@@@@@@@@@@@@",
 };
 #endif /* ~TERMGL_MINIMAL */
 
+static void *reserve(void *buf, unsigned *capacity, size_t elem_size, unsigned size);
+#ifndef TERMGL_MINIMAL
+static int atlas_item_cmp(const void *a, const void *b);
+static int atlas_palette_index(TGLAtlas *atlas, unsigned *n_colors, TGLPixFmt color);
+#endif /* ~TERMGL_MINIMAL */
 static inline bool rgb_eq(TGLRGB a, TGLRGB b);
 static inline bool fmt_eq(TGLFmt a, TGLFmt b);
 static inline bool pixfmt_eq(TGLPixFmt a, TGLPixFmt b);
+static inline bool pixfmt_identical(TGLPixFmt a, TGLPixFmt b);
+enum ScissorEdge {
+	SCISSOR_LEFT = 0,
+	SCISSOR_RIGHT,
+	SCISSOR_TOP,
+	SCISSOR_BOTTOM,
+};
+
 static inline void clip(const TGL *tgl, int *x, int *y);
+static inline uint8_t scissor_outcode(const TGL *tgl, int x, int y);
+static inline int scissor_dist(const TGL *tgl, int x, int y, enum ScissorEdge edge);
+static TGLVert lerp_vert(TGLVert a, TGLVert b, float d);
+static inline TGLVert fetch_vert(
+	const void *verts, size_t stride, const unsigned *indices, unsigned i);
+static inline void strip_line(TGL *tgl, TGLVert v0, uint8_t out0, TGLVert v1, uint8_t out1,
+	TGLPixelShader *t, const void *data);
+static bool clip_line(const TGL *tgl, TGLVert *v0, TGLVert *v1);
+static unsigned clip_polygon_edge(
+	const TGL *tgl, enum ScissorEdge edge, const TGLVert *in, unsigned n_in, TGLVert *out);
+static inline bool hiz_enabled(const TGL *tgl);
+static void hiz_clear(TGL *tgl, bool dirty);
+static float hiz_tile_depth(TGL *tgl, unsigned tx, unsigned ty);
+static bool hiz_occluded(TGL *tgl, int x0, int y0, int x1, int y1, float z);
 static inline char *generate_sgr_rgb_channel(uint8_t val, char *buf);
 static char *generate_sgr_rgb(TGLRGB rgb, char *buf);
 static char *generate_sgr(TGLPixFmt color_prev, TGLPixFmt color_cur, char *buf);
+static void compose_layer(TGL *tgl, const TGLLayer *layer);
 static void horiz_line(TGL *tgl, int x0, float z0, uint8_t u0, uint8_t v0, int x1, float z1,
 	uint8_t u1, uint8_t v1, int y, TGLPixelShader *t, const void *data);
+static inline void horiz_pixel(TGL *tgl, SpanBatch *batch, int x, int y, float z, uint8_t u,
+	uint8_t v, TGLPixelShader *t, const void *data);
+static void span_flush(TGL *tgl, SpanBatch *batch, int y);
+static void bresenham_line(TGL *tgl, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void fill_triangle(
+	TGL *tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *t, const void *data);
+#ifdef TERMGL3D
+static void itgl_pixel_shader_varyings(
+	uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+static void itgl_span_varyings(TGL *tgl, int x0, int x1, int y, const VaryingsRaster *raster);
+#endif
+
+void tgl_pixel_shader_span(const uint8_t u, const uint8_t v, TGLPixFmt *const color,
+	char *const c, const void *const data)
+{
+	const TGLPixelShaderSpan *const span = data;
+	const uint8_t uv[1][2] = { { u, v } };
+	span->shader(1, uv, color, c, span->data);
+}
 
 #ifndef TERMGL_MINIMAL
 void tgl_pixel_shader_simple(const uint8_t u, const uint8_t v, TGLPixFmt *const color,
 	char *const c, const void *const data)
 {
 	const TGLPixelShaderSimple *const interp = data;
-	*color = interp->color;
-	*c = tgl_grad_char(interp->grad, u + v);
-	(void)v;
+	const TGLGradient *const grad = interp->grad;
+	const uint8_t intensity = u + v;
+	*color = grad->colors ? grad->colors[intensity] : interp->color;
+	*c = TGL_LIKELY(grad->lut != NULL) ? grad->lut[intensity]
+				   : grad->grad[grad->length * intensity / 256U];
 }
 
 void tgl_pixel_shader_texture(
@@ -123,12 +253,158 @@ void tgl_pixel_shader_texture(
 	*c = shader->chars[idx];
 }
 
+void tgl_pixel_shader_atlas(const uint8_t u, const uint8_t v, TGLPixFmt *const color,
+	char *const c, const void *const data)
+{
+	const TGLAtlasTexture *const tex = data;
+	const TGLTexel texel =
+		tex->texels[((v * tex->height) >> 8) * tex->stride + ((u * tex->width) >> 8)];
+	*color = tex->palette[texel.color];
+	*c = texel.c;
+}
+
 char tgl_grad_char(const TGLGradient *const grad, const uint8_t intensity)
 {
-	return grad->grad[grad->length * intensity / 256U];
+	return TGL_LIKELY(grad->lut != NULL) ? grad->lut[intensity]
+				     : grad->grad[grad->length * intensity / 256U];
+}
+
+void tgl_gradient_lut(const TGLGradient *const grad, char *const lut)
+{
+	unsigned i;
+	for (i = 0; i < 256; i++)
+		lut[i] = grad->grad[grad->length * i / 256U];
+}
+
+/* Orders textures from tallest to shortest */
+int atlas_item_cmp(const void *const a, const void *const b)
+{
+	const unsigned ha = ((const AtlasItem *)a)->height, hb = ((const AtlasItem *)b)->height;
+	return (ha < hb) - (ha > hb);
+}
+
+/* Finds or adds a color in an atlas' palette
+ * @return index of the color, -1 if the palette is full
+ **/
+int atlas_palette_index(TGLAtlas *const atlas, unsigned *const n_colors, const TGLPixFmt color)
+{
+	unsigned i;
+	for (i = 0; i < *n_colors; i++)
+		if (pixfmt_identical(atlas->palette[i], color))
+			return (int)i;
+	if (*n_colors == 256)
+		return -1;
+	atlas->palette[*n_colors] = color;
+	return (int)(*n_colors)++;
+}
+
+TGLAtlas *tgl_atlas_create(const TGLPixelShaderTexture *const textures, const unsigned count,
+	TGLAtlasTexture *const out)
+{
+	AtlasItem *const items = TGL_MALLOC(sizeof(AtlasItem) * (count ? count : 1));
+	if (!items)
+		return NULL;
+
+	/* Shelf packing of the textures from tallest to shortest into rows at least as wide as the
+	 * widest texture, aiming for a square atlas */
+	unsigned area = 0, width = 0;
+	unsigned i;
+	for (i = 0; i < count; i++) {
+		items[i] = (AtlasItem){
+			.idx = i,
+			.height = textures[i].height,
+		};
+		area += textures[i].width * textures[i].height;
+		width = MAX(width, (unsigned)textures[i].width);
+	}
+	while (width * width < area)
+		width++;
+	qsort(items, count, sizeof(AtlasItem), &atlas_item_cmp);
+	unsigned x = 0, y = 0, shelf_height = 0;
+	for (i = 0; i < count; i++) {
+		if (x + textures[items[i].idx].width > width) {
+			x = 0;
+			y += shelf_height;
+			shelf_height = 0;
+		}
+		items[i].x = x;
+		items[i].y = y;
+		x += textures[items[i].idx].width;
+		shelf_height = MAX(shelf_height, items[i].height);
+	}
+	const unsigned height = y + shelf_height;
+
+	TGLAtlas *const atlas = TGL_MALLOC(sizeof(TGLAtlas) + sizeof(TGLTexel) * width * height);
+	if (!atlas) {
+		TGL_FREE(items);
+		return NULL;
+	}
+	*atlas = (TGLAtlas){
+		.width = width,
+		.height = height,
+		.texels = (TGLTexel *)(atlas + 1),
+	};
+	memset(atlas->texels, 0, sizeof(TGLTexel) * width * height);
+
+	unsigned n_colors = 0;
+	for (i = 0; i < count; i++) {
+		const TGLPixelShaderTexture *const tex = &textures[items[i].idx];
+		TGLTexel *const origin = &atlas->texels[items[i].y * width + items[i].x];
+		unsigned tx, ty;
+		for (ty = 0; ty < tex->height; ty++) {
+			for (tx = 0; tx < tex->width; tx++) {
+				const int color = atlas_palette_index(
+					atlas, &n_colors, tex->colors[ty * tex->width + tx]);
+				if (color < 0) {
+					TGL_FREE(items);
+					TGL_FREE(atlas);
+					errno = EINVAL;
+					return NULL;
+				}
+				origin[ty * width + tx] = (TGLTexel){
+					.c = tex->chars[ty * tex->width + tx],
+					.color = (uint8_t)color,
+				};
+			}
+		}
+		out[items[i].idx] = (TGLAtlasTexture){
+			.texels = origin,
+			.palette = atlas->palette,
+			.stride = width,
+			.width = tex->width,
+			.height = tex->height,
+		};
+	}
+
+	TGL_FREE(items);
+	return atlas;
+}
+
+void tgl_atlas_delete(TGLAtlas *const atlas)
+{
+	TGL_FREE(atlas);
 }
 #endif /* ~TERMGL_MINIMAL */
 
+/* Grows a buffer so that it can hold at least size elements, preserving its contents
+ * @return the (possibly reallocated) buffer, NULL on failure in which case buf remains valid
+ **/
+void *reserve(
+	void *const buf, unsigned *const capacity, const size_t elem_size, const unsigned size)
+{
+	if (size <= *capacity)
+		return buf;
+	const unsigned new_capacity = MAX(size, *capacity * 2U);
+	void *const new_buf = TGL_MALLOC(elem_size * new_capacity);
+	if (!new_buf)
+		return NULL;
+	if (buf)
+		memcpy(new_buf, buf, elem_size * *capacity);
+	TGL_FREE(buf);
+	*capacity = new_capacity;
+	return new_buf;
+}
+
 bool rgb_eq(const TGLRGB a, const TGLRGB b)
 {
 	return (a.r == b.r) && (a.g == b.g) && (a.b == b.b);
@@ -146,15 +422,181 @@ bool pixfmt_eq(const TGLPixFmt a, const TGLPixFmt b)
 	return fmt_eq(a.fg, b.fg) && fmt_eq(a.bkg, b.bkg);
 }
 
+/* Unlike pixfmt_eq, also compares flags such as TGL_BOLD */
+bool pixfmt_identical(const TGLPixFmt a, const TGLPixFmt b)
+{
+	return a.fg.flags == b.fg.flags && a.bkg.flags == b.bkg.flags && pixfmt_eq(a, b);
+}
+
+/* Clamps a point to the scissor rectangle */
 void clip(const TGL *const tgl, int *const x, int *const y)
 {
-	*x = MAX(MIN(tgl->max_x, *x), 0);
-	*y = MAX(MIN(tgl->max_y, *y), 0);
+	*x = MAX(MIN(tgl->scissor_x1, *x), tgl->scissor_x0);
+	*y = MAX(MIN(tgl->scissor_y1, *y), tgl->scissor_y0);
+}
+
+uint8_t scissor_outcode(const TGL *const tgl, const int x, const int y)
+{
+	return ((x < tgl->scissor_x0) << SCISSOR_LEFT) | ((x > tgl->scissor_x1) << SCISSOR_RIGHT)
+		| ((y < tgl->scissor_y0) << SCISSOR_TOP)
+		| ((y > tgl->scissor_y1) << SCISSOR_BOTTOM);
+}
+
+/* Signed distance of a point from a scissor edge, non-negative if inside */
+int scissor_dist(const TGL *const tgl, const int x, const int y, const enum ScissorEdge edge)
+{
+	switch (edge) {
+	case SCISSOR_LEFT:
+		return x - tgl->scissor_x0;
+	case SCISSOR_RIGHT:
+		return tgl->scissor_x1 - x;
+	case SCISSOR_TOP:
+		return y - tgl->scissor_y0;
+	case SCISSOR_BOTTOM:
+		return tgl->scissor_y1 - y;
+	default:
+		TGL_UNREACHABLE();
+		return 0;
+	}
+}
+
+TGLVert lerp_vert(const TGLVert a, const TGLVert b, const float d)
+{
+	return (TGLVert){
+		.x = a.x + ROUND((b.x - a.x) * d),
+		.y = a.y + ROUND((b.y - a.y) * d),
+		.z = a.z + (b.z - a.z) * d,
+		.u = a.u + ROUND((b.u - a.u) * d),
+		.v = a.v + ROUND((b.v - a.v) * d),
+	};
+}
+
+/* Reads the i-th vertex of a strided, optionally indexed, vertex buffer */
+TGLVert fetch_vert(const void *const verts, const size_t stride, const unsigned *const indices,
+	const unsigned i)
+{
+	TGLVert v;
+	memcpy(&v, (const char *)verts + (size_t)(indices ? indices[i] : i) * stride,
+		sizeof(TGLVert));
+	return v;
+}
+
+/* Liang-Barsky line clipping against the scissor rectangle
+ * @return false if the line lies entirely outside
+ **/
+bool clip_line(const TGL *const tgl, TGLVert *const v0, TGLVert *const v1)
+{
+	const int dx = v1->x - v0->x;
+	const int dy = v1->y - v0->y;
+	const int p[4] = { -dx, dx, -dy, dy };
+	const int q[4] = {
+		scissor_dist(tgl, v0->x, v0->y, SCISSOR_LEFT),
+		scissor_dist(tgl, v0->x, v0->y, SCISSOR_RIGHT),
+		scissor_dist(tgl, v0->x, v0->y, SCISSOR_TOP),
+		scissor_dist(tgl, v0->x, v0->y, SCISSOR_BOTTOM),
+	};
+	float t0 = 0.f, t1 = 1.f;
+	unsigned i;
+	for (i = 0; i < 4; i++) {
+		if (p[i] == 0) {
+			if (q[i] < 0)
+				return false;
+		} else {
+			const float r = q[i] / (float)p[i];
+			if (p[i] < 0) {
+				if (r > t1)
+					return false;
+				t0 = MAX(t0, r);
+			} else {
+				if (r < t0)
+					return false;
+				t1 = MIN(t1, r);
+			}
+		}
+	}
+	const TGLVert a = *v0, b = *v1;
+	if (t0 > 0.f) {
+		*v0 = lerp_vert(a, b, t0);
+		clip(tgl, &v0->x, &v0->y);
+	}
+	if (t1 < 1.f) {
+		*v1 = lerp_vert(a, b, t1);
+		clip(tgl, &v1->x, &v1->y);
+	}
+	return true;
+}
+
+/* Sutherland-Hodgman clipping of a convex polygon against a single scissor edge */
+unsigned clip_polygon_edge(const TGL *const tgl, const enum ScissorEdge edge,
+	const TGLVert *const in, const unsigned n_in, TGLVert *const out)
+{
+	unsigned n_out = 0;
+	unsigned i;
+	for (i = 0; i < n_in; i++) {
+		const TGLVert a = in[i];
+		const TGLVert b = in[(i + 1) % n_in];
+		const int da = scissor_dist(tgl, a.x, a.y, edge);
+		const int db = scissor_dist(tgl, b.x, b.y, edge);
+		if (da >= 0)
+			out[n_out++] = a;
+		if ((da < 0 && db > 0) || (da > 0 && db < 0))
+			out[n_out++] = lerp_vert(a, b, da / (float)(da - db));
+	}
+	return n_out;
+}
+
+bool hiz_enabled(const TGL *const tgl)
+{
+	return tgl->hiz_buffer && tgl->z_buffer_enabled;
+}
+
+void hiz_clear(TGL *const tgl, const bool dirty)
+{
+	const unsigned size = tgl->hiz_width * tgl->hiz_height;
+	unsigned i;
+	for (i = 0; i < size; i++) {
+		tgl->hiz_buffer[i] = -1.F;
+		tgl->hiz_dirty[i] = dirty;
+	}
+}
+
+/* Lazily recomputes the farthest depth of a tile after pixels in it have been written */
+float hiz_tile_depth(TGL *const tgl, const unsigned tx, const unsigned ty)
+{
+	const unsigned idx = ty * tgl->hiz_width + tx;
+	if (tgl->hiz_dirty[idx]) {
+		const unsigned x0 = tx << HIZ_SHIFT_X;
+		const unsigned y0 = ty << HIZ_SHIFT_Y;
+		const unsigned x1 = MIN(x0 + (1U << HIZ_SHIFT_X), tgl->width);
+		const unsigned y1 = MIN(y0 + (1U << HIZ_SHIFT_Y), tgl->height);
+		float depth = tgl->z_buffer[y0 * tgl->width + x0];
+		unsigned x, y;
+		for (y = y0; y < y1; y++)
+			for (x = x0; x < x1; x++)
+				depth = MIN(depth, tgl->z_buffer[y * tgl->width + x]);
+		tgl->hiz_buffer[idx] = depth;
+		tgl->hiz_dirty[idx] = false;
+	}
+	return tgl->hiz_buffer[idx];
+}
+
+/* Checks if depth z fails the depth test everywhere in the on-screen rectangle (x0, y0)-(x1, y1) */
+bool hiz_occluded(TGL *const tgl, const int x0, const int y0, const int x1, const int y1,
+	const float z)
+{
+	const unsigned tx0 = x0 >> HIZ_SHIFT_X, tx1 = x1 >> HIZ_SHIFT_X;
+	const unsigned ty0 = y0 >> HIZ_SHIFT_Y, ty1 = y1 >> HIZ_SHIFT_Y;
+	unsigned tx, ty;
+	for (ty = ty0; ty <= ty1; ty++)
+		for (tx = tx0; tx <= tx1; tx++)
+			if (z >= hiz_tile_depth(tgl, tx, ty))
+				return false;
+	return true;
 }
 
 void set_pixel_raw(TGL *const tgl, const int x, const int y, const char c, const TGLPixFmt color)
 {
-	tgl->frame_buffer[y * tgl->width + x] = (Pixel){
+	tgl->frame_buffer[y * tgl->width + x] = (TGLPixel){
 		.v_char = c,
 		.color = color,
 	};
@@ -172,6 +614,9 @@ void set_pixel(TGL *const tgl, const int x, const int y, const float z, const ui
 		t(u, v, &color, &c, data);
 		set_pixel_raw(tgl, x, y, c, color);
 		(tgl)->z_buffer[(y) * (tgl)->width + (x)] = z;
+		if (tgl->hiz_buffer)
+			tgl->hiz_dirty[(y >> HIZ_SHIFT_Y) * tgl->hiz_width + (x >> HIZ_SHIFT_X)] =
+				true;
 	}
 }
 
@@ -199,15 +644,18 @@ void tgl_clear(TGL *const tgl, const uint8_t buffers)
 	unsigned i;
 	if (buffers & TGL_FRAME_BUFFER) {
 		for (i = 0; i < tgl->frame_size; i++) {
-			*(&tgl->frame_buffer[i]) = (Pixel){
+			*(&tgl->frame_buffer[i]) = (TGLPixel){
 				.v_char = ' ',
 				.color = (TGLPixFmt){ 0 },
 			};
 		}
 	}
-	if (buffers & TGL_Z_BUFFER)
+	if (buffers & TGL_Z_BUFFER) {
 		for (i = 0; i < tgl->frame_size; i++)
 			tgl->z_buffer[i] = -1.F;
+		if (tgl->hiz_buffer)
+			hiz_clear(tgl, false);
+	}
 	if (buffers & TGL_OUTPUT_BUFFER)
 		memset(tgl->output_buffer, '\0', tgl->output_buffer_size);
 }
@@ -227,8 +675,10 @@ TGL *tgl_init(const unsigned width, const unsigned height)
 		.height = height,
 		.max_x = width - 1,
 		.max_y = height - 1,
+		.scissor_x1 = width - 1,
+		.scissor_y1 = height - 1,
 		.frame_size = width * height,
-		.frame_buffer = TGL_MALLOC(sizeof(Pixel) * width * height),
+		.frame_buffer = TGL_MALLOC(sizeof(TGLPixel) * width * height),
 	};
 	if (!tgl->frame_buffer) {
 		TGL_FREE(tgl);
@@ -344,8 +794,114 @@ char *generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, char *
 	return buf;
 }
 
+void compose_layer(TGL *const tgl, const TGLLayer *const layer)
+{
+	const int x0 = MAX(layer->x, 0);
+	const int y0 = MAX(layer->y, 0);
+	const int x1 = MIN(layer->x + (int)layer->width - 1, tgl->max_x);
+	const int y1 = MIN(layer->y + (int)layer->height - 1, tgl->max_y);
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	int row, col;
+	for (row = y0; row <= y1; row++) {
+		TGLPixel *const dst = &tgl->frame_buffer[row * tgl->width + x0];
+		const TGLPixel *const src =
+			&layer->pixels[(row - layer->y) * layer->width + (x0 - layer->x)];
+		if (!layer->transparent) {
+			memcpy(dst, src, sizeof(TGLPixel) * (x1 - x0 + 1));
+			continue;
+		}
+		for (col = 0; col <= x1 - x0; col++)
+			if (src[col].v_char != layer->transparent)
+				dst[col] = src[col];
+	}
+}
+
+TGLLayer *tgl_layer_create(TGL *const tgl, const unsigned width, const unsigned height)
+{
+	TGLLayer **const layers =
+		reserve(tgl->layers, &tgl->layers_capacity, sizeof(TGLLayer *), tgl->n_layers + 1);
+	if (!layers)
+		return NULL;
+	tgl->layers = layers;
+
+	TGLLayer *const layer = TGL_MALLOC(sizeof(TGLLayer) + sizeof(TGLPixel) * width * height);
+	if (!layer)
+		return NULL;
+	*layer = (TGLLayer){
+		.width = width,
+		.height = height,
+		.transparent = ' ',
+		.visible = true,
+		.pixels = (TGLPixel *)(layer + 1),
+	};
+	tgl_layer_clear(layer);
+	tgl->layers[tgl->n_layers++] = layer;
+	return layer;
+}
+
+void tgl_layer_delete(TGL *const tgl, TGLLayer *const layer)
+{
+	unsigned i;
+	for (i = 0; i < tgl->n_layers; i++) {
+		if (tgl->layers[i] == layer) {
+			memmove(&tgl->layers[i], &tgl->layers[i + 1],
+				sizeof(TGLLayer *) * (tgl->n_layers - i - 1));
+			tgl->n_layers--;
+			break;
+		}
+	}
+	TGL_FREE(layer);
+}
+
+void tgl_layer_clear(TGLLayer *const layer)
+{
+	const TGLPixel blank = (TGLPixel){
+		.v_char = layer->transparent ? layer->transparent : ' ',
+		.color = TGL_PIXFMT(TGL_IDX(TGL_BLACK)),
+	};
+	unsigned i;
+	for (i = 0; i < layer->width * layer->height; i++)
+		layer->pixels[i] = blank;
+}
+
+void tgl_layer_puts(
+	TGLLayer *const layer, const int x, int y, const char *str, const TGLPixFmt color)
+{
+	int cur_x = x;
+	while (*str) {
+		if (TGL_UNLIKELY(*str == '\n')) {
+			cur_x = x;
+			y++;
+			str++;
+			continue;
+		}
+		if (cur_x >= 0 && y >= 0 && cur_x < (int)layer->width && y < (int)layer->height)
+			layer->pixels[y * layer->width + cur_x] = (TGLPixel){
+				.v_char = *str,
+				.color = color,
+			};
+		cur_x++;
+		str++;
+	}
+}
+
 int tgl_flush(TGL *const tgl)
 {
+	/* Composite layers in order of increasing z using insertion sort, as their order rarely
+	 * changes */
+	unsigned i, j;
+	for (i = 1; i < tgl->n_layers; i++) {
+		TGLLayer *const layer = tgl->layers[i];
+		for (j = i; j > 0 && tgl->layers[j - 1]->z > layer->z; j--)
+			tgl->layers[j] = tgl->layers[j - 1];
+		tgl->layers[j] = layer;
+	}
+	for (i = 0; i < tgl->n_layers; i++)
+		if (tgl->layers[i]->visible)
+			compose_layer(tgl, tgl->layers[i]);
+
 	if (tgl->settings & TGL_PROGRESSIVE)
 		CALL_STDOUT(fputs("\033[;H", stdout), -1);
 	else
@@ -353,7 +909,7 @@ int tgl_flush(TGL *const tgl)
 
 	TGLPixFmt color = TGL_PIXFMT(TGL_IDX(TGL_WHITE));
 	unsigned row, col;
-	Pixel *pixel = tgl->frame_buffer;
+	TGLPixel *pixel = tgl->frame_buffer;
 	const bool double_chars = tgl->settings & TGL_DOUBLE_CHARS;
 	const bool double_width = tgl->settings & TGL_DOUBLE_WIDTH;
 
@@ -408,10 +964,57 @@ int tgl_flush(TGL *const tgl)
 	return 0;
 }
 
-void tgl_putchar(TGL *const tgl, int x, int y, const char c, const TGLPixFmt color)
+void tgl_scissor(TGL *const tgl, int x0, int y0, int x1, int y1)
+{
+	tgl->scissor_x0 = MAX(x0, 0);
+	tgl->scissor_y0 = MAX(y0, 0);
+	tgl->scissor_x1 = MIN(x1, tgl->max_x);
+	tgl->scissor_y1 = MIN(y1, tgl->max_y);
+}
+
+void tgl_rect_fill(TGL *const tgl, const int x, const int y, const unsigned width,
+	const unsigned height, const char c, const TGLPixFmt color)
+{
+	const int x0 = MAX(x, tgl->scissor_x0);
+	const int y0 = MAX(y, tgl->scissor_y0);
+	const int x1 = MIN(x + (int)width - 1, tgl->scissor_x1);
+	const int y1 = MIN(y + (int)height - 1, tgl->scissor_y1);
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	TGLPixel *const first = &tgl->frame_buffer[y0 * tgl->width + x0];
+	const unsigned row_size = sizeof(TGLPixel) * (x1 - x0 + 1);
+	int col, row;
+	for (col = 0; col <= x1 - x0; col++)
+		first[col] = (TGLPixel){
+			.v_char = c,
+			.color = color,
+		};
+	for (row = 1; row <= y1 - y0; row++)
+		memcpy(first + row * tgl->width, first, row_size);
+}
+
+void tgl_blit(TGL *const tgl, const int x, const int y, const unsigned width,
+	const unsigned height, const TGLPixel *const pixels)
+{
+	const int x0 = MAX(x, tgl->scissor_x0);
+	const int y0 = MAX(y, tgl->scissor_y0);
+	const int x1 = MIN(x + (int)width - 1, tgl->scissor_x1);
+	const int y1 = MIN(y + (int)height - 1, tgl->scissor_y1);
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	const unsigned row_size = sizeof(TGLPixel) * (x1 - x0 + 1);
+	int row;
+	for (row = y0; row <= y1; row++)
+		memcpy(&tgl->frame_buffer[row * tgl->width + x0],
+			&pixels[(row - y) * width + (x0 - x)], row_size);
+}
+
+void tgl_putchar(TGL *const tgl, const int x, const int y, const char c, const TGLPixFmt color)
 {
-	clip(tgl, &x, &y);
-	set_pixel_raw(tgl, x, y, c, color);
+	if (!scissor_outcode(tgl, x, y))
+		set_pixel_raw(tgl, x, y, c, color);
 }
 
 void tgl_puts(TGL *const tgl, const int x, int y, const char *str, const TGLPixFmt color)
@@ -424,26 +1027,113 @@ void tgl_puts(TGL *const tgl, const int x, int y, const char *str, const TGLPixF
 			str++;
 			continue;
 		}
-		clip(tgl, &cur_x, &y);
-		set_pixel_raw(tgl, cur_x, y, *str, color);
+		if (!scissor_outcode(tgl, cur_x, y))
+			set_pixel_raw(tgl, cur_x, y, *str, color);
 		cur_x++;
 		str++;
 	}
 }
 
-void tgl_point(TGL *const tgl, TGLVert v0, TGLPixelShader *const t, const void *const data)
+void tgl_point(TGL *const tgl, const TGLVert v0, TGLPixelShader *const t, const void *const data)
 {
-	clip(tgl, &v0.x, &v0.y);
-	set_pixel(tgl, v0.x, v0.y, v0.z, v0.u, v0.v, t, data);
+	if (!scissor_outcode(tgl, v0.x, v0.y))
+		set_pixel(tgl, v0.x, v0.y, v0.z, v0.u, v0.v, t, data);
 }
 
-/* Bresenham's line algorithm */
 void tgl_line(
 	TGL *const tgl, TGLVert v0, TGLVert v1, TGLPixelShader *const t, const void *const data)
 {
-	clip(tgl, &v0.x, &v0.y);
-	clip(tgl, &v1.x, &v1.y);
-	if (abs(v1.y - v0.y) < abs(v1.x - v0.x)) {
+	strip_line(tgl, v0, scissor_outcode(tgl, v0.x, v0.y), v1, scissor_outcode(tgl, v1.x, v1.y),
+		t, data);
+}
+
+/* Draws a line whose vertices' scissor outcodes are already known */
+void strip_line(TGL *const tgl, TGLVert v0, const uint8_t out0, TGLVert v1, const uint8_t out1,
+	TGLPixelShader *const t, const void *const data)
+{
+	if (out0 & out1)
+		return;
+	if ((out0 | out1) && !clip_line(tgl, &v0, &v1))
+		return;
+	bresenham_line(tgl, v0, v1, t, data);
+}
+
+void tgl_points(TGL *const tgl, const void *const verts, size_t stride,
+	const unsigned *const indices, const unsigned count, TGLPixelShader *const t,
+	const void *const data)
+{
+	if (!stride)
+		stride = sizeof(TGLVert);
+	unsigned i;
+	for (i = 0; i < count; i++) {
+		const TGLVert v = fetch_vert(verts, stride, indices, i);
+		if (!scissor_outcode(tgl, v.x, v.y))
+			set_pixel(tgl, v.x, v.y, v.z, v.u, v.v, t, data);
+	}
+}
+
+void tgl_lines(TGL *const tgl, const void *const verts, size_t stride,
+	const unsigned *const indices, const unsigned count, TGLPixelShader *const t,
+	const void *const data)
+{
+	if (!stride)
+		stride = sizeof(TGLVert);
+	unsigned i;
+	for (i = 0; i + 1 < count; i += 2) {
+		const TGLVert v0 = fetch_vert(verts, stride, indices, i);
+		const TGLVert v1 = fetch_vert(verts, stride, indices, i + 1);
+		strip_line(tgl, v0, scissor_outcode(tgl, v0.x, v0.y), v1,
+			scissor_outcode(tgl, v1.x, v1.y), t, data);
+	}
+}
+
+void tgl_line_strip(TGL *const tgl, const void *const verts, size_t stride,
+	const unsigned *const indices, const unsigned count, TGLPixelShader *const t,
+	const void *const data)
+{
+	if (!stride)
+		stride = sizeof(TGLVert);
+	if (!count)
+		return;
+	TGLVert prev = fetch_vert(verts, stride, indices, 0);
+	uint8_t prev_out = scissor_outcode(tgl, prev.x, prev.y);
+	unsigned i;
+	for (i = 1; i < count; i++) {
+		const TGLVert cur = fetch_vert(verts, stride, indices, i);
+		const uint8_t cur_out = scissor_outcode(tgl, cur.x, cur.y);
+		strip_line(tgl, prev, prev_out, cur, cur_out, t, data);
+		prev = cur;
+		prev_out = cur_out;
+	}
+}
+
+void tgl_triangles(TGL *const tgl, const void *const verts, size_t stride,
+	const unsigned *const indices, const unsigned count, const bool fill,
+	TGLPixelShader *const t, const void *const data)
+{
+	if (!stride)
+		stride = sizeof(TGLVert);
+	unsigned i;
+	for (i = 0; i + 2 < count; i += 3) {
+		const TGLVert v0 = fetch_vert(verts, stride, indices, i);
+		const TGLVert v1 = fetch_vert(verts, stride, indices, i + 1);
+		const TGLVert v2 = fetch_vert(verts, stride, indices, i + 2);
+		if (fill)
+			tgl_triangle_fill(tgl, v0, v1, v2, t, data);
+		else
+			tgl_triangle(tgl, v0, v1, v2, t, data);
+	}
+}
+
+/* Bresenham's line algorithm
+ * Both vertices must lie inside the scissor rectangle
+ **/
+void bresenham_line(
+	TGL *const tgl, TGLVert v0, TGLVert v1, TGLPixelShader *const t, const void *const data)
+{
+	if (v0.x == v1.x && v0.y == v1.y) {
+		set_pixel(tgl, v0.x, v0.y, v0.z, v0.u, v0.v, t, data);
+	} else if (abs(v1.y - v0.y) < abs(v1.x - v0.x)) {
 		if (v0.x > v1.x) {
 			SWAP(TGLVert, v1, v0);
 		}
@@ -460,7 +1150,7 @@ void tgl_line(
 		int y = v0.y;
 		int x;
 		for (x = v0.x; x <= v1.x; x++) {
-			set_pixel(tgl, x, y, ((x - v0.x) * v1.z + (v0.x - x) * v1.z) / dx,
+			set_pixel(tgl, x, y, ((x - v0.x) * v1.z + (v1.x - x) * v0.z) / dx,
 				((x - v0.x) * v1.u + (v1.x - x) * v0.u) / dx,
 				((x - v0.x) * v1.v + (v1.x - x) * v0.v) / dx, t, data);
 			if (d > 0) {
@@ -487,7 +1177,7 @@ void tgl_line(
 		int x = v0.x;
 		int y;
 		for (y = v0.y; y <= v1.y; y++) {
-			set_pixel(tgl, x, y, ((y - v0.y) * v1.z + (v1.y - y) * v0.z) / dx,
+			set_pixel(tgl, x, y, ((y - v0.y) * v1.z + (v1.y - y) * v0.z) / dy,
 				((y - v0.y) * v1.u + (v1.y - y) * v0.u) / dy,
 				((y - v0.y) * v1.v + (v1.y - y) * v0.v) / dy, t, data);
 			if (d > 0) {
@@ -512,28 +1202,134 @@ void horiz_line(TGL *const tgl, const int x0, const float z0, const uint8_t u0,
 	const int x1, const float z1, const uint8_t u1, const uint8_t v1, const int y,
 	TGLPixelShader *t, const void *const data)
 {
+#ifdef TERMGL3D
+	/* Varyings are interpolated from the triangle's unrounded vertices instead */
+	if (t == &itgl_pixel_shader_varyings) {
+		itgl_span_varyings(tgl, x0, x1, y, data);
+		return;
+	}
+#endif
+
+	/* Span shaders are called once for all pixels of the span passing the depth test */
+	SpanBatch batch;
+	SpanBatch *const span = (t == &tgl_pixel_shader_span) ? &batch : NULL;
+	if (span) {
+		batch.span = data;
+		batch.count = 0;
+	}
+
 	if (x0 == x1) {
 		set_pixel(tgl, x0, y, z0, u0, v0, t, data);
+	} else if (hiz_enabled(tgl)) {
+		/* Skip parts of the span lying in tiles which are entirely in front of it */
+		const int dx = x1 - x0;
+		int x = x0;
+		while (x <= x1) {
+			const int x_end = MIN(x | HIZ_MASK_X, x1);
+			const float z_begin = ((x - x0) * z1 + (x1 - x) * z0) / dx;
+			const float z_end = ((x_end - x0) * z1 + (x1 - x_end) * z0) / dx;
+			if (MAX(z_begin, z_end)
+				< hiz_tile_depth(tgl, x >> HIZ_SHIFT_X, y >> HIZ_SHIFT_Y)) {
+				x = x_end + 1;
+				continue;
+			}
+			for (; x <= x_end; x++) {
+				horiz_pixel(tgl, span, x, y, ((x - x0) * z1 + (x1 - x) * z0) / dx,
+					((x - x0) * u1 + (x1 - x) * u0) / dx,
+					((x - x0) * v1 + (x1 - x) * v0) / dx, t, data);
+			}
+		}
 	} else {
 		const int dx = x1 - x0;
 		int x;
 		for (x = x0; x <= x1; x++) {
-			set_pixel(tgl, x, y, ((x - x0) * z1 + (x1 - x) * z0) / dx,
+			horiz_pixel(tgl, span, x, y, ((x - x0) * z1 + (x1 - x) * z0) / dx,
 				((x - x0) * u1 + (x1 - x) * u0) / dx,
 				((x - x0) * v1 + (x1 - x) * v0) / dx, t, data);
 		}
 	}
+
+	if (span)
+		span_flush(tgl, span, y);
+}
+
+/* Draws a pixel of a span, deferring shading to span_flush if batch is not NULL */
+void horiz_pixel(TGL *const tgl, SpanBatch *const batch, const int x, const int y, const float z,
+	const uint8_t u, const uint8_t v, TGLPixelShader *const t, const void *const data)
+{
+	if (!batch) {
+		set_pixel(tgl, x, y, z, u, v, t, data);
+		return;
+	}
+	if (tgl->z_buffer_enabled) {
+		if (z < tgl->z_buffer[y * tgl->width + x])
+			return;
+		tgl->z_buffer[y * tgl->width + x] = z;
+		if (tgl->hiz_buffer)
+			tgl->hiz_dirty[(y >> HIZ_SHIFT_Y) * tgl->hiz_width + (x >> HIZ_SHIFT_X)] =
+				true;
+	}
+	batch->x[batch->count] = x;
+	batch->uv[batch->count][0] = u;
+	batch->uv[batch->count][1] = v;
+	if (++batch->count == SPAN_BATCH_SIZE)
+		span_flush(tgl, batch, y);
+}
+
+void span_flush(TGL *const tgl, SpanBatch *const batch, const int y)
+{
+	TGLPixFmt color[SPAN_BATCH_SIZE];
+	char c[SPAN_BATCH_SIZE];
+	if (!batch->count)
+		return;
+	batch->span->shader(
+		batch->count, (const uint8_t(*)[2])batch->uv, color, c, batch->span->data);
+	unsigned i;
+	for (i = 0; i < batch->count; i++)
+		set_pixel_raw(tgl, batch->x[i], y, c[i], color[i]);
+	batch->count = 0;
+}
+
+void tgl_triangle_fill(TGL *const tgl, const TGLVert v0, const TGLVert v1, const TGLVert v2,
+	TGLPixelShader *const t, const void *data)
+{
+	const uint8_t out0 = scissor_outcode(tgl, v0.x, v0.y);
+	const uint8_t out1 = scissor_outcode(tgl, v1.x, v1.y);
+	const uint8_t out2 = scissor_outcode(tgl, v2.x, v2.y);
+	if (out0 & out1 & out2)
+		return;
+	if (!(out0 | out1 | out2)) {
+		fill_triangle(tgl, v0, v1, v2, t, data);
+		return;
+	}
+
+	/* A triangle clipped by 4 edges has at most 7 vertices */
+	TGLVert poly[2][7] = { { v0, v1, v2 } };
+	unsigned n = 3, cur = 0;
+	unsigned edge;
+	for (edge = SCISSOR_LEFT; edge <= SCISSOR_BOTTOM; edge++) {
+		if (!((out0 | out1 | out2) & (1U << edge)))
+			continue;
+		n = clip_polygon_edge(tgl, edge, poly[cur], n, poly[!cur]);
+		cur = !cur;
+		if (n < 3)
+			return;
+	}
+
+	unsigned i;
+	for (i = 0; i < n; i++)
+		clip(tgl, &poly[cur][i].x, &poly[cur][i].y);
+	for (i = 1; i + 1 < n; i++)
+		fill_triangle(tgl, poly[cur][0], poly[cur][i], poly[cur][i + 1], t, data);
 }
 
 /* Solution based on Bresenham's line algorithm
  * adapted from: https://github.com/OneLoneCoder/videos/blob/master/olcConsoleGameEngine.h
+ * All vertices must lie inside the scissor rectangle
  **/
-void tgl_triangle_fill(TGL *const tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *const t,
+void fill_triangle(TGL *const tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *const t,
 	const void *data)
 {
-	clip(tgl, &v0.x, &v0.y);
-	clip(tgl, &v1.x, &v1.y);
-	clip(tgl, &v2.x, &v2.y);
 	if (v1.y < v0.y) {
 		SWAP(TGLVert, v1, v0);
 	}
@@ -544,6 +1340,11 @@ void tgl_triangle_fill(TGL *const tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPi
 		SWAP(TGLVert, v1, v2);
 	}
 
+	if (hiz_enabled(tgl)
+		&& hiz_occluded(tgl, MIN(MIN(v0.x, v1.x), v2.x), v0.y, MAX(MAX(v0.x, v1.x), v2.x),
+			v2.y, MAX(MAX(v0.z, v1.z), v2.z)))
+		return;
+
 	int t0xp, t1xp, minx, maxx, t0x, t1x;
 	t0x = t1x = v0.x;
 	int y = v0.y;
@@ -750,9 +1551,9 @@ LBL_NEXT:
 	};
 }
 
-int tgl_enable(TGL *const tgl, const uint8_t settings)
+int tgl_enable(TGL *const tgl, const uint16_t settings)
 {
-	const uint8_t enable = settings & ~tgl->settings;
+	const uint16_t enable = settings & ~tgl->settings;
 	tgl->settings |= settings;
 	if (enable & TGL_Z_BUFFER) {
 		tgl->z_buffer_enabled = true;
@@ -761,6 +1562,17 @@ int tgl_enable(TGL *const tgl, const uint8_t settings)
 			return -1;
 		tgl_clear(tgl, TGL_Z_BUFFER);
 	}
+	if (enable & TGL_HIZ_BUFFER) {
+		tgl->hiz_width = (tgl->width + HIZ_MASK_X) >> HIZ_SHIFT_X;
+		tgl->hiz_height = (tgl->height + (1U << HIZ_SHIFT_Y) - 1) >> HIZ_SHIFT_Y;
+		const unsigned hiz_size = tgl->hiz_width * tgl->hiz_height;
+		tgl->hiz_buffer = TGL_MALLOC((sizeof(float) + sizeof(bool)) * hiz_size);
+		if (!tgl->hiz_buffer)
+			return -1;
+		tgl->hiz_dirty = (bool *)(tgl->hiz_buffer + hiz_size);
+		/* The depth buffer may already hold a partially drawn frame */
+		hiz_clear(tgl, true);
+	}
 	if (enable & TGL_OUTPUT_BUFFER) {
 		/* Longest non-rgb SGR code: \033[22;24;XX;10Xm (length 15)
 		 * Longest rgb SGR code: \033[22;24;38;2;XXX;XXX;XXX;48;2;XXX;XXX;XXXm (length 42)
@@ -779,7 +1591,7 @@ int tgl_enable(TGL *const tgl, const uint8_t settings)
 	return 0;
 }
 
-void tgl_disable(TGL *const tgl, const uint8_t settings)
+void tgl_disable(TGL *const tgl, const uint16_t settings)
 {
 	tgl->settings &= ~settings;
 	if (settings & TGL_Z_BUFFER) {
@@ -787,6 +1599,11 @@ void tgl_disable(TGL *const tgl, const uint8_t settings)
 		TGL_FREE(tgl->z_buffer);
 		tgl->z_buffer = NULL;
 	}
+	if (settings & TGL_HIZ_BUFFER) {
+		TGL_FREE(tgl->hiz_buffer);
+		tgl->hiz_buffer = NULL;
+		tgl->hiz_dirty = NULL;
+	}
 	if (settings & TGL_OUTPUT_BUFFER) {
 		tgl->output_buffer_size = 0;
 		TGL_FREE(tgl->output_buffer);
@@ -798,14 +1615,46 @@ void tgl_delete(TGL *const tgl)
 {
 	TGL_FREE(tgl->frame_buffer);
 	TGL_FREE(tgl->z_buffer);
+	TGL_FREE(tgl->hiz_buffer);
 	TGL_FREE(tgl->output_buffer);
-	TGL_FREE(tgl);
-}
-
+	unsigned i;
+	for (i = 0; i < tgl->n_layers; i++)
+		TGL_FREE(tgl->layers[i]);
+	TGL_FREE(tgl->layers);
+#ifdef TERMGL3D
+	TGL_FREE(tgl->vert_cache);
+	TGL_FREE(tgl->vert_gather);
+	TGL_FREE(tgl->vert_remap);
+	TGL_FREE(tgl->tri_visible);
+	TGL_FREE(tgl->vert_varyings);
+#ifndef TERMGL_MINIMAL
+	TGL_FREE(tgl->vert_light);
+#endif
+#endif
+	TGL_FREE(tgl);
+}
+
 #ifdef TERMGL3D
 
+#include <limits.h>
 #include <math.h>
 
+#ifndef TERMGL_MINIMAL
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TGL_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+/* AVX2 code is compiled for the target attribute, and only used if the CPU supports it at
+ * runtime */
+#define TGL_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define TGL_NEON
+#include <arm_neon.h>
+#endif
+#endif /* ~TERMGL_MINIMAL */
+
 #define TGL_CULL_FACE_BIT 0x01
 #define TGL_WINDING_BIT 0x02
 
@@ -855,16 +1704,186 @@ enum ClipPlane {
 	CLIP_BOTTOM,
 };
 
+/* The side planes are only clipped against once a triangle leaves a guard band GUARD_BAND times
+ * the size of the view volume. Anything within it is left to the 2D clipper, which is far
+ * cheaper */
+#define GUARD_BAND 8.f
+
+/* Outcode bits, in addition to (1 << ClipPlane) for each clipping plane */
+enum {
+	OUT_CLIP_PLANES = 0x3F,
+	OUT_VIEW_LEFT = 0x40,
+	OUT_VIEW_RIGHT = 0x80,
+	OUT_VIEW_TOP = 0x100,
+	OUT_VIEW_BOTTOM = 0x200,
+	OUT_VIEW_VOLUME = (1 << CLIP_NEAR) | (1 << CLIP_FAR) | OUT_VIEW_LEFT | OUT_VIEW_RIGHT
+		| OUT_VIEW_TOP | OUT_VIEW_BOTTOM,
+};
+
+/* Output of a primitive shader */
+typedef struct FlatShade {
+	TGLPixFmt color;
+	char c;
+} FlatShade;
+
 typedef struct TGLUVTriangle {
 	TGLVec4 verts[3];
 	uint8_t uv[3][2];
 } TGLUVTriangle;
 
+/* Clip Space vertex followed by its varyings */
+typedef float VaryingVert[4 + TGL_MAX_VARYINGS];
+
+/* A triangle clipped by all 6 planes has at most 9 vertices */
+#define CLIP_POLYGON_SIZE 9
+
+#ifndef TERMGL_MINIMAL
+/* Maximum number of triangles in a leaf of a scene's BVH */
+#define SCENE_LEAF_SIZE 64
+
+/* Node of a scene's BVH. Leaves are self-contained meshes, so only the vertices of visible leaves
+ * are transformed */
+typedef struct SceneNode {
+	TGLVec3 aabb[2];
+	unsigned child; /* index of the first of two child nodes, or of a leaf's first triangle */
+	unsigned n_tris; /* 0 for inner nodes */
+	unsigned first_vert;
+	unsigned n_verts;
+} SceneNode;
+
+/* Triangle referenced during BVH construction */
+typedef struct SceneTri {
+	unsigned mesh;
+	unsigned idx;
+	TGLVec3 centroid;
+} SceneTri;
+
+/* Grid resolution of the finest simplified level of detail */
+#define LOD_MAX_RES 256
+
+typedef struct LODKey {
+	uint64_t key; /* grid cell, 16 bits per axis */
+	unsigned vert;
+} LODKey;
+
+typedef struct LODLevel {
+	TGLMesh mesh;
+	unsigned res; /* grid resolution vertices were merged on, UINT_MAX for the original mesh */
+} LODLevel;
+
+struct TGLMeshLOD {
+	unsigned n_levels;
+	LODLevel *levels; /* from finest to coarsest */
+};
+
+/* Mip level of a texture, whose dimensions are powers of two */
+typedef struct TextureLevel {
+	const char *chars;
+	const TGLPixFmt *colors;
+	uint8_t shift_u; /* shift mapping u onto a column, i.e. 8 - log2(width) */
+	uint8_t shift_v;
+	uint8_t log2_width;
+} TextureLevel;
+
+struct TGLTexture {
+	unsigned n_levels;
+	float texel_area; /* area of a UV unit square in texels of level 0 */
+	TextureLevel *levels; /* from finest to coarsest */
+};
+
+struct TGLScene {
+	SceneNode *nodes;
+	unsigned n_nodes;
+	unsigned nodes_capacity;
+	TGLVec3 *verts;
+	unsigned n_verts;
+	unsigned verts_capacity;
+	uint8_t (*uvs)[2];
+	unsigned uvs_capacity;
+	TGLVec3 *vert_normals;
+	unsigned vert_normals_capacity;
+	unsigned *indices;
+	TGLVec3 *normals; /* normal of each triangle, for backface culling before vertex shading */
+	bool has_uvs;
+	bool has_vert_normals;
+};
+#endif /* ~TERMGL_MINIMAL */
+
 static void itgl_clip_line(float dot_i, const TGLVec4 vec_i, const uint8_t uv_i[2], float dot_o,
 	const TGLVec4 vec_o, const uint8_t uv_o[2], TGLVec4 vec_out, uint8_t uv_out[2]);
 static unsigned itgl_clip_triangle_plane(
 	enum ClipPlane plane, const TGLUVTriangle *in, TGLUVTriangle *out);
 static float itgl_clip_plane_dot(const TGLVec4 v, enum ClipPlane plane);
+static unsigned itgl_outcode(const TGLVec4 v);
+static bool itgl_hiz_reject(TGL *tgl, const TGLVec4 *verts, unsigned n);
+#ifndef TERMGL_MINIMAL
+static unsigned itgl_aabb_corners(const TGLMat mat, const TGLVec3 aabb[2], TGLVec4 corners[8]);
+static void itgl_aabb_union(TGLVec3 aabb[2], const TGLVec3 other[2]);
+static void itgl_scene_tri_bounds(const TGLMesh *meshes, const SceneTri *tri, TGLVec3 aabb[2]);
+static void itgl_scene_select(SceneTri *tris, unsigned lo, unsigned hi, unsigned k, unsigned axis);
+static int itgl_scene_leaf(TGLScene *scene, const TGLMesh *meshes, const unsigned *vert_offsets,
+	unsigned *remap, const SceneTri *tris, unsigned first, unsigned n_tris, SceneNode *node);
+static int itgl_scene_build(TGLScene *scene, const TGLMesh *meshes, const unsigned *vert_offsets,
+	unsigned *remap, SceneTri *tris, unsigned first, unsigned n_tris, unsigned node_idx);
+static int itgl_scene_draw_node(TGL *tgl, const TGLScene *scene, unsigned node_idx,
+	const TGLMat mat, const TGLVec4 eye, bool fill, TGLVertexShaderBatch *vert_shader,
+	const void *vert_data, TGLPixelShader *frag_shader, const void *frag_data);
+static uint8_t itgl_vertex_light(
+	const TGLLighting *lighting, const TGLVec3 vert, const TGLVec3 normal);
+static void itgl_texture_downsample(const TextureLevel *src, unsigned src_width,
+	unsigned src_height, char *chars, TGLPixFmt *colors, unsigned width, unsigned height);
+static const TextureLevel *itgl_texture_level(
+	const TGL *tgl, const TGLTexture *texture, const TGLVec4 verts[3], const uint8_t (*uv)[2]);
+static void itgl_pixel_shader_texture_level(
+	uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+static const uint8_t *itgl_light_verts(TGL *tgl, const TGLMesh *mesh, const unsigned *remap);
+#endif /* ~TERMGL_MINIMAL */
+#ifndef TERMGL_MINIMAL
+typedef void TGLMulmatvecSoa(const TGLMat mat, const float *x, const float *y, const float *z,
+	unsigned count, float *out_x, float *out_y, float *out_z, float *out_w);
+static TGLMulmatvecSoa itgl_mulmatvec_soa_scalar;
+#ifdef TGL_SSE2
+static TGLMulmatvecSoa itgl_mulmatvec_soa_sse2;
+#endif
+#ifdef TGL_AVX2
+static TGLMulmatvecSoa itgl_mulmatvec_soa_avx2;
+#endif
+#ifdef TGL_NEON
+static TGLMulmatvecSoa itgl_mulmatvec_soa_neon;
+#endif
+static int itgl_lod_key_cmp(const void *a, const void *b);
+static int itgl_lod_level(
+	const TGLMesh *mesh, unsigned res, LODKey *keys, unsigned *cluster, TGLMesh *out);
+#endif /* ~TERMGL_MINIMAL */
+static bool itgl_reject_triangle(
+	TGL *tgl, const TGLVec4 verts[3], bool cull_face, unsigned *clip_planes);
+static void itgl_triangle(TGL *tgl, const TGLVec4 verts[3], const TGLVec3 *obj,
+	const uint8_t (*uv)[2], bool fill, bool cull_face, TGLPixelShader *frag_shader,
+	const void *frag_data);
+static void itgl_pixel_shader_flat(
+	uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+static void itgl_triangle_strip_3d(TGL *tgl, const TGLVec3 *in, const uint8_t (*uv)[2],
+	unsigned count, bool fan, bool fill, TGLVertexShaderBatch *vert_shader,
+	const void *vert_data, TGLPixelShader *frag_shader, const void *frag_data);
+static void itgl_eye(const TGLMat mat, TGLVec4 eye);
+static bool itgl_back_face(
+	const TGL *tgl, const TGLVec4 eye, const TGLVec3 normal, const TGLVec3 vert);
+static int itgl_gather_front_faces(
+	TGL *tgl, const TGLMesh *mesh, const float *eye, unsigned *n_verts, unsigned *n_tris);
+static int itgl_draw_mesh(TGL *tgl, const TGLMesh *mesh, const float *eye, bool fill,
+	TGLVertexShaderBatch *vert_shader, const void *vert_data, TGLPixelShader *frag_shader,
+	const void *frag_data);
+static void itgl_triangle_varyings(TGL *tgl, const TGLVec4 verts[3], const float *const varyings[3],
+	unsigned n_varyings, bool cull_face, TGLPixelShaderVaryings *frag_shader,
+	const void *frag_data);
+static unsigned itgl_clip_polygon_plane(enum ClipPlane plane, const VaryingVert *in, unsigned n_in,
+	unsigned n_varyings, VaryingVert *out);
+static void itgl_raster_varyings(TGL *tgl, const float *const verts[3], unsigned n_varyings,
+	TGLPixelShaderVaryings *frag_shader, const void *frag_data);
+static void itgl_clip_triangle(TGL *tgl, const TGLVec4 verts[3], const uint8_t (*uv)[2],
+	unsigned clip_planes, bool fill, TGLPixelShader *frag_shader, const void *frag_data);
+static void itgl_draw_triangle(TGL *tgl, const TGLVec4 verts[3], const uint8_t (*uv)[2],
+	bool fill, TGLPixelShader *frag_shader, const void *frag_data);
 
 #ifndef TERMGL_MINIMAL
 float tgl_sqr(const float val)
@@ -945,6 +1964,149 @@ void tgl_mulmatvec(const TGLMat mat, const TGLVec3 vec, TGLVec4 res)
 	res[3] = tgl_dot43(mat[3], vec);
 }
 
+/* Selected on every call rather than cached, so that no state is shared between threads. Only
+ * AVX2 depends on the CPU, and __builtin_cpu_supports just reads data initialized at startup */
+void tgl_mulmatvec_soa(const TGLMat mat, const float *const x, const float *const y,
+	const float *const z, const unsigned count, float *const out_x, float *const out_y,
+	float *const out_z, float *const out_w)
+{
+#if defined(TGL_AVX2)
+	if (__builtin_cpu_supports("avx2"))
+		itgl_mulmatvec_soa_avx2(mat, x, y, z, count, out_x, out_y, out_z, out_w);
+	else
+		itgl_mulmatvec_soa_sse2(mat, x, y, z, count, out_x, out_y, out_z, out_w);
+#elif defined(TGL_SSE2)
+	itgl_mulmatvec_soa_sse2(mat, x, y, z, count, out_x, out_y, out_z, out_w);
+#elif defined(TGL_NEON)
+	itgl_mulmatvec_soa_neon(mat, x, y, z, count, out_x, out_y, out_z, out_w);
+#else
+	itgl_mulmatvec_soa_scalar(mat, x, y, z, count, out_x, out_y, out_z, out_w);
+#endif
+}
+
+/* Operations are performed in the same order as in tgl_dot43 by all implementations, so results
+ * are identical */
+void itgl_mulmatvec_soa_scalar(const TGLMat mat, const float *const x, const float *const y,
+	const float *const z, const unsigned count, float *const out_x, float *const out_y,
+	float *const out_z, float *const out_w)
+{
+	float *const out[4] = { out_x, out_y, out_z, out_w };
+	unsigned r, i;
+	for (r = 0; r < 4; r++)
+		for (i = 0; i < count; i++)
+			out[r][i] = mat[r][0] * x[i] + mat[r][1] * y[i] + mat[r][2] * z[i]
+				+ mat[r][3];
+}
+
+#ifdef TGL_SSE2
+void itgl_mulmatvec_soa_sse2(const TGLMat mat, const float *const x, const float *const y,
+	const float *const z, const unsigned count, float *const out_x, float *const out_y,
+	float *const out_z, float *const out_w)
+{
+	float *const out[4] = { out_x, out_y, out_z, out_w };
+	__m128 m[4][4];
+	unsigned r, c, i;
+	for (r = 0; r < 4; r++)
+		for (c = 0; c < 4; c++)
+			m[r][c] = _mm_set1_ps(mat[r][c]);
+	for (i = 0; i + 4 <= count; i += 4) {
+		const __m128 vx = _mm_loadu_ps(x + i);
+		const __m128 vy = _mm_loadu_ps(y + i);
+		const __m128 vz = _mm_loadu_ps(z + i);
+		for (r = 0; r < 4; r++)
+			_mm_storeu_ps(out[r] + i,
+				_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], vx),
+							      _mm_mul_ps(m[r][1], vy)),
+						   _mm_mul_ps(m[r][2], vz)),
+					m[r][3]));
+	}
+	itgl_mulmatvec_soa_scalar(mat, x + i, y + i, z + i, count - i, out_x + i, out_y + i,
+		out_z + i, out_w + i);
+}
+#endif /* TGL_SSE2 */
+
+#ifdef TGL_AVX2
+__attribute__((target("avx2"))) void itgl_mulmatvec_soa_avx2(const TGLMat mat,
+	const float *const x, const float *const y, const float *const z, const unsigned count,
+	float *const out_x, float *const out_y, float *const out_z, float *const out_w)
+{
+	float *const out[4] = { out_x, out_y, out_z, out_w };
+	__m256 m[4][4];
+	unsigned r, c, i;
+	for (r = 0; r < 4; r++)
+		for (c = 0; c < 4; c++)
+			m[r][c] = _mm256_set1_ps(mat[r][c]);
+	for (i = 0; i + 8 <= count; i += 8) {
+		const __m256 vx = _mm256_loadu_ps(x + i);
+		const __m256 vy = _mm256_loadu_ps(y + i);
+		const __m256 vz = _mm256_loadu_ps(z + i);
+		for (r = 0; r < 4; r++) {
+			__m256 acc = _mm256_mul_ps(m[r][0], vx);
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(m[r][1], vy));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(m[r][2], vz));
+			_mm256_storeu_ps(out[r] + i, _mm256_add_ps(acc, m[r][3]));
+		}
+	}
+	itgl_mulmatvec_soa_sse2(mat, x + i, y + i, z + i, count - i, out_x + i, out_y + i,
+		out_z + i, out_w + i);
+}
+#endif /* TGL_AVX2 */
+
+#ifdef TGL_NEON
+void itgl_mulmatvec_soa_neon(const TGLMat mat, const float *const x, const float *const y,
+	const float *const z, const unsigned count, float *const out_x, float *const out_y,
+	float *const out_z, float *const out_w)
+{
+	float *const out[4] = { out_x, out_y, out_z, out_w };
+	float32x4_t m[4][4];
+	unsigned r, c, i;
+	for (r = 0; r < 4; r++)
+		for (c = 0; c < 4; c++)
+			m[r][c] = vdupq_n_f32(mat[r][c]);
+	for (i = 0; i + 4 <= count; i += 4) {
+		const float32x4_t vx = vld1q_f32(x + i);
+		const float32x4_t vy = vld1q_f32(y + i);
+		const float32x4_t vz = vld1q_f32(z + i);
+		for (r = 0; r < 4; r++)
+			vst1q_f32(out[r] + i,
+				vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(m[r][0], vx),
+							    vmulq_f32(m[r][1], vy)),
+						  vmulq_f32(m[r][2], vz)),
+					m[r][3]));
+	}
+	itgl_mulmatvec_soa_scalar(mat, x + i, y + i, z + i, count - i, out_x + i, out_y + i,
+		out_z + i, out_w + i);
+}
+#endif /* TGL_NEON */
+
+/* Transforms vertices in blocks, converting between array-of-structs and struct-of-arrays
+ * layouts */
+void tgl_vertex_shader_simple_batch(
+	const TGLVec3 *const in, TGLVec4 *const out, const unsigned count, const void *const data)
+{
+	const TGLVertexShaderSimple *simple = data;
+	enum { BLOCK = 64 };
+	float soa_in[3][BLOCK], soa_out[4][BLOCK];
+	unsigned i;
+	for (i = 0; i < count; i += BLOCK) {
+		const unsigned n = MIN(count - i, (unsigned)BLOCK);
+		unsigned j;
+		for (j = 0; j < n; j++) {
+			soa_in[0][j] = in[i + j][0];
+			soa_in[1][j] = in[i + j][1];
+			soa_in[2][j] = in[i + j][2];
+		}
+		tgl_mulmatvec_soa(simple->mat, soa_in[0], soa_in[1], soa_in[2], n, soa_out[0],
+			soa_out[1], soa_out[2], soa_out[3]);
+		for (j = 0; j < n; j++) {
+			out[i + j][0] = soa_out[0][j];
+			out[i + j][1] = soa_out[1][j];
+			out[i + j][2] = soa_out[2][j];
+			out[i + j][3] = soa_out[3][j];
+		}
+	}
+}
+
 void tgl_mulmat(const TGLMat mat1, const TGLMat mat2, TGLMat res)
 {
 	unsigned c, d, k;
@@ -1026,13 +2188,13 @@ float itgl_clip_plane_dot(const TGLVec4 v, const enum ClipPlane plane)
 {
 	switch (plane) {
 	case CLIP_LEFT:
-		return v[0] + v[3];
+		return v[0] + GUARD_BAND * v[3];
 	case CLIP_RIGHT:
-		return -v[0] + v[3];
+		return -v[0] + GUARD_BAND * v[3];
 	case CLIP_BOTTOM:
-		return v[1] + v[3];
+		return v[1] + GUARD_BAND * v[3];
 	case CLIP_TOP:
-		return -v[1] + v[3];
+		return -v[1] + GUARD_BAND * v[3];
 	case CLIP_NEAR:
 		return v[2] + v[3];
 	case CLIP_FAR:
@@ -1043,6 +2205,24 @@ float itgl_clip_plane_dot(const TGLVec4 v, const enum ClipPlane plane)
 	}
 }
 
+unsigned itgl_outcode(const TGLVec4 v)
+{
+	unsigned code = 0;
+	unsigned p;
+	for (p = 0; p < 6; p++)
+		if (itgl_clip_plane_dot(v, p) < 0.f)
+			code |= 1U << p;
+	if (v[0] < -v[3])
+		code |= OUT_VIEW_LEFT;
+	if (v[0] > v[3])
+		code |= OUT_VIEW_RIGHT;
+	if (v[1] > v[3])
+		code |= OUT_VIEW_TOP;
+	if (v[1] < -v[3])
+		code |= OUT_VIEW_BOTTOM;
+	return code;
+}
+
 unsigned itgl_clip_triangle_plane(
 	const enum ClipPlane plane, const TGLUVTriangle *const in, TGLUVTriangle *const out)
 {
@@ -1062,7 +2242,7 @@ unsigned itgl_clip_triangle_plane(
 	case 0:
 		return 0;
 	case 1:
-		memcpy(out[0].verts[0], in->verts[inside[0]], sizeof(TGLUVTriangle));
+		memcpy(out[0].verts[0], in->verts[inside[0]], sizeof(TGLVec4));
 		memcpy(out[0].uv[0], in->uv[inside[0]], sizeof(uint8_t[2]));
 		itgl_clip_line(dps[inside[0]], in->verts[inside[0]], in->uv[inside[0]],
 			dps[outside[0]], in->verts[outside[0]], in->uv[outside[0]], out[0].verts[1],
@@ -1098,6 +2278,36 @@ unsigned itgl_clip_triangle_plane(
 	}
 }
 
+/* Rejects the convex hull of n vertices lying entirely in front of the near plane if it is hidden
+ * by the hierarchical depth buffer */
+bool itgl_hiz_reject(TGL *const tgl, const TGLVec4 *const verts, const unsigned n)
+{
+	const float half_width = tgl->width * .5f;
+	const float half_height = tgl->height * .5f;
+	float min_x = (float)tgl->max_x, max_x = 0.f, min_y = (float)tgl->max_y, max_y = 0.f;
+	float max_z = -1.f;
+	unsigned i;
+	for (i = 0; i < n; i++) {
+		if (verts[i][3] <= 0.f || itgl_clip_plane_dot(verts[i], CLIP_NEAR) < 0.f)
+			return false;
+		const float inv_w = 1.f / verts[i][3];
+		const float x = MAP_COORD(half_width, verts[i][0] * inv_w);
+		const float y = MAP_COORD(half_height, verts[i][1] * inv_w);
+		min_x = MIN(min_x, x);
+		max_x = MAX(max_x, x);
+		min_y = MIN(min_y, y);
+		max_y = MAX(max_y, y);
+		max_z = MAX(max_z, verts[i][2] * inv_w);
+	}
+	min_x = MAX(min_x, 0.f);
+	min_y = MAX(min_y, 0.f);
+	max_x = MIN(max_x, (float)tgl->max_x);
+	max_y = MIN(max_y, (float)tgl->max_y);
+	if (min_x > max_x || min_y > max_y)
+		return false;
+	return hiz_occluded(tgl, (int)min_x, (int)min_y, (int)max_x, (int)max_y, max_z);
+}
+
 void tgl_triangle_3d(TGL *const tgl, const TGLTriangle in, const uint8_t (*const uv)[2],
 	const bool fill, TGLVertexShader *const vert_shader, const void *const vert_data,
 	TGLPixelShader *frag_shader, const void *const frag_data)
@@ -1108,199 +2318,1704 @@ void tgl_triangle_3d(TGL *const tgl, const TGLTriangle in, const uint8_t (*const
 	for (i = 0; i < 3; i++)
 		vert_shader(in[i], verts[i], vert_data);
 
-	/* Backface culling */
-	if (tgl->settings & TGL_CULL_FACE) {
-		TGLVec3 v0s, v1s, v2s, ab, ac, cp;
-		tgl_mul3s(verts[0], 1.f / verts[0][3], v0s);
-		tgl_mul3s(verts[1], 1.f / verts[1][3], v1s);
-		tgl_mul3s(verts[2], 1.f / verts[2][3], v2s);
-		tgl_sub3v(v1s, v0s, ab);
-		tgl_sub3v(v2s, v0s, ac);
-		tgl_cross(ab, ac, cp);
-		if (XOR(tgl->settings & TGL_CULL_BIT, signbit(cp[2])))
-			return;
+	itgl_triangle(tgl, (const TGLVec4 *)verts, in, uv, fill, true, frag_shader, frag_data);
+}
+
+void tgl_triangles_3d(TGL *const tgl, const TGLTriangle *const in, const uint8_t (*const uv)[3][2],
+	const unsigned count, const bool fill, TGLVertexShaderBatch *const vert_shader,
+	const void *const vert_data, TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	enum { BLOCK = 64 };
+	TGLVec4 verts[BLOCK][3];
+	const uint8_t no_uv[3][2] = { { 0 } };
+	unsigned i;
+	for (i = 0; i < count; i += BLOCK) {
+		const unsigned n = MIN(count - i, (unsigned)BLOCK);
+		vert_shader(in[i], verts[0], 3 * n, vert_data);
+		unsigned j;
+		for (j = 0; j < n; j++)
+			itgl_triangle(tgl, (const TGLVec4 *)verts[j], in[i + j],
+				uv ? (const uint8_t(*)[2])uv[i + j] : no_uv, fill, true,
+				frag_shader, frag_data);
 	}
+}
 
-	/* Clipping */
-	TGLUVTriangle trig_buffer
-		[127]; /* the size of this buffer assumes a pathological case which is probably impossible */
-	memcpy(&(trig_buffer[0].verts), verts, sizeof(TGLVec4[3]));
-	memcpy(&(trig_buffer[0].uv), uv, sizeof(uint8_t[3][2]));
-	unsigned buffer_offset = 0;
-	unsigned n_cur_stage = 1;
-	unsigned p;
-	for (p = 0; p < 6; p++) {
-		unsigned n_next_stage = 0;
-		for (i = 0; i < n_cur_stage; i++) {
-			n_next_stage += itgl_clip_triangle_plane(p, &trig_buffer[i + buffer_offset],
-				&trig_buffer[buffer_offset + n_cur_stage + n_next_stage]);
+/* Renders a triangle strip or fan, carrying the last two transformed vertices over between
+ * blocks */
+void itgl_triangle_strip_3d(TGL *const tgl, const TGLVec3 *const in, const uint8_t (*const uv)[2],
+	const unsigned count, const bool fan, const bool fill,
+	TGLVertexShaderBatch *const vert_shader, const void *const vert_data,
+	TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	enum { BLOCK = 64 };
+	TGLVec4 verts[BLOCK + 2];
+	uint8_t uvs[BLOCK + 2][2] = { { 0 } };
+	TGLVec4 first;
+	uint8_t first_uv[2];
+	unsigned n_carry = 0;
+	unsigned base = 0; /* index of verts[0] in the strip */
+	unsigned i, j;
+	for (i = 0; i < count; i += BLOCK) {
+		const unsigned n = MIN(count - i, (unsigned)BLOCK);
+		vert_shader(&in[i], &verts[n_carry], n, vert_data);
+		if (uv)
+			memcpy(&uvs[n_carry], &uv[i], sizeof(uint8_t[2]) * n);
+		if (!i) {
+			memcpy(first, verts[0], sizeof(TGLVec4));
+			memcpy(first_uv, uvs[0], sizeof(uint8_t[2]));
 		}
-		buffer_offset += n_cur_stage;
-		n_cur_stage = n_next_stage;
+
+		const unsigned total = n_carry + n;
+		for (j = 0; j + 2 < total; j++) {
+			TGLVec4 trig[3];
+			uint8_t trig_uv[3][2];
+			/* Every other triangle of a strip is flipped to keep the winding
+			 * consistent */
+			const unsigned v0 = (base + j) & 1 ? j + 1 : j;
+			const unsigned v1 = (base + j) & 1 ? j : j + 1;
+			if (fan) {
+				memcpy(trig[0], first, sizeof(TGLVec4));
+				memcpy(trig_uv[0], first_uv, sizeof(uint8_t[2]));
+				memcpy(trig[1], verts[j + 1], sizeof(TGLVec4));
+				memcpy(trig_uv[1], uvs[j + 1], sizeof(uint8_t[2]));
+			} else {
+				memcpy(trig[0], verts[v0], sizeof(TGLVec4));
+				memcpy(trig_uv[0], uvs[v0], sizeof(uint8_t[2]));
+				memcpy(trig[1], verts[v1], sizeof(TGLVec4));
+				memcpy(trig_uv[1], uvs[v1], sizeof(uint8_t[2]));
+			}
+			memcpy(trig[2], verts[j + 2], sizeof(TGLVec4));
+			memcpy(trig_uv[2], uvs[j + 2], sizeof(uint8_t[2]));
+			TGLTriangle obj;
+			if (tgl->prim_shader) {
+				memcpy(obj[0], in[fan ? 0 : base + v0], sizeof(TGLVec3));
+				memcpy(obj[1], in[base + (fan ? j + 1 : v1)], sizeof(TGLVec3));
+				memcpy(obj[2], in[base + j + 2], sizeof(TGLVec3));
+			}
+			itgl_triangle(tgl, (const TGLVec4 *)trig, (const TGLVec3 *)obj,
+				(const uint8_t(*)[2])trig_uv, fill, true, frag_shader, frag_data);
+		}
+
+		n_carry = MIN(total, 2U);
+		memmove(verts[0], verts[total - n_carry], sizeof(TGLVec4) * n_carry);
+		memmove(uvs[0], uvs[total - n_carry], sizeof(uint8_t[2]) * n_carry);
+		base += total - n_carry;
 	}
+}
 
-	float half_width = tgl->width * .5f;
-	float half_height = tgl->height * .5f;
+void tgl_triangle_strip_3d(TGL *const tgl, const TGLVec3 *const in, const uint8_t (*const uv)[2],
+	const unsigned count, const bool fill, TGLVertexShaderBatch *const vert_shader,
+	const void *const vert_data, TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	itgl_triangle_strip_3d(
+		tgl, in, uv, count, false, fill, vert_shader, vert_data, frag_shader, frag_data);
+}
 
-	/* Drawing */
-	for (i = 0; i < n_cur_stage; i++) {
-		TGLVec3 v[3];
-		unsigned j;
-		for (j = 0; j < 3; j++)
-			tgl_mul3s(trig_buffer[i + buffer_offset].verts[j],
-				1.f / trig_buffer[i + buffer_offset].verts[j][3], v[j]);
+void tgl_triangle_fan_3d(TGL *const tgl, const TGLVec3 *const in, const uint8_t (*const uv)[2],
+	const unsigned count, const bool fill, TGLVertexShaderBatch *const vert_shader,
+	const void *const vert_data, TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	itgl_triangle_strip_3d(
+		tgl, in, uv, count, true, fill, vert_shader, vert_data, frag_shader, frag_data);
+}
 
-		if (fill)
-			tgl_triangle_fill(tgl,
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[0][0]),
-					.y = MAP_COORD(half_height, v[0][1]),
-					.z = v[0][2],
-					.u = trig_buffer[i + buffer_offset].uv[0][0],
-					.v = trig_buffer[i + buffer_offset].uv[0][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[1][0]),
-					.y = MAP_COORD(half_height, v[1][1]),
-					.z = v[1][2],
-					.u = trig_buffer[i + buffer_offset].uv[1][0],
-					.v = trig_buffer[i + buffer_offset].uv[1][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[2][0]),
-					.y = MAP_COORD(half_height, v[2][1]),
-					.z = v[2][2],
-					.u = trig_buffer[i + buffer_offset].uv[2][0],
-					.v = trig_buffer[i + buffer_offset].uv[2][1],
-				},
-				frag_shader, frag_data);
-		else
-			tgl_triangle(tgl,
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[0][0]),
-					.y = MAP_COORD(half_height, v[0][1]),
-					.z = v[0][2],
-					.u = trig_buffer[i + buffer_offset].uv[0][0],
-					.v = trig_buffer[i + buffer_offset].uv[0][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[1][0]),
-					.y = MAP_COORD(half_height, v[1][1]),
-					.z = v[1][2],
-					.u = trig_buffer[i + buffer_offset].uv[1][0],
-					.v = trig_buffer[i + buffer_offset].uv[1][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[2][0]),
-					.y = MAP_COORD(half_height, v[2][1]),
-					.z = v[2][2],
-					.u = trig_buffer[i + buffer_offset].uv[2][0],
-					.v = trig_buffer[i + buffer_offset].uv[2][1],
-				},
-				frag_shader, frag_data);
-	}
+int tgl_draw_mesh(TGL *const tgl, const TGLMesh *const mesh, const bool fill,
+	TGLVertexShaderBatch *const vert_shader, const void *const vert_data,
+	TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	return itgl_draw_mesh(tgl, mesh, tgl->cull_eye_enabled ? tgl->cull_eye : NULL, fill,
+		vert_shader, vert_data, frag_shader, frag_data);
 }
 
-void tgl_cull_face(TGL *const tgl, const uint8_t settings)
+/* Culls the back faces of a mesh with normals in object space, listing front faces in tri_visible
+ * and gathering the vertices they use into vert_gather, with vert_remap mapping vertices of the
+ * mesh into it
+ * @return 0 on success, -1 on failure
+ **/
+int itgl_gather_front_faces(TGL *const tgl, const TGLMesh *const mesh, const float *const eye,
+	unsigned *const n_verts, unsigned *const n_tris)
 {
-	tgl->settings = (tgl->settings & ~TGL_CULL_BIT)
-		| (XOR(settings & TGL_CULL_FACE_BIT, settings & TGL_WINDING_BIT) ? TGL_CULL_BIT :
-										   0);
+	TGLVec3 *const gather = reserve(tgl->vert_gather, &tgl->vert_gather_capacity,
+		sizeof(TGLVec3), mesh->n_verts);
+	if (!gather)
+		return -1;
+	tgl->vert_gather = gather;
+	unsigned *const remap = reserve(tgl->vert_remap, &tgl->vert_remap_capacity,
+		sizeof(unsigned), mesh->n_verts);
+	if (!remap)
+		return -1;
+	tgl->vert_remap = remap;
+	unsigned *const visible = reserve(
+		tgl->tri_visible, &tgl->tri_visible_capacity, sizeof(unsigned), mesh->n_triangles);
+	if (!visible)
+		return -1;
+	tgl->tri_visible = visible;
+
+	unsigned i, j;
+	for (i = 0; i < mesh->n_verts; i++)
+		remap[i] = UINT_MAX;
+	*n_verts = 0;
+	*n_tris = 0;
+	for (i = 0; i < mesh->n_triangles; i++) {
+		const unsigned *const idx = &mesh->indices[3 * i];
+		if (itgl_back_face(tgl, eye, mesh->normals[i], mesh->verts[idx[0]]))
+			continue;
+		visible[(*n_tris)++] = i;
+		for (j = 0; j < 3; j++) {
+			if (remap[idx[j]] == UINT_MAX) {
+				remap[idx[j]] = *n_verts;
+				memcpy(gather[(*n_verts)++], mesh->verts[idx[j]], sizeof(TGLVec3));
+			}
+		}
+	}
+	return 0;
 }
 
-#endif /* TERMGL3D */
+/* Draws a mesh, culling back faces in object space before vertex shading if eye is not NULL and
+ * the mesh has normals */
+int itgl_draw_mesh(TGL *const tgl, const TGLMesh *const mesh, const float *const eye,
+	const bool fill, TGLVertexShaderBatch *const vert_shader, const void *const vert_data,
+	TGLPixelShader *frag_shader, const void *frag_data)
+{
+	/* Buffers reserved for an empty mesh stay NULL, which would be mistaken for a failure */
+	if (!mesh->n_triangles)
+		return 0;
+	const bool object_cull = eye && mesh->normals && (tgl->settings & TGL_CULL_FACE);
+	TGLVec4 *const cache =
+		reserve(tgl->vert_cache, &tgl->vert_cache_capacity, sizeof(TGLVec4), mesh->n_verts);
+	if (!cache)
+		return -1;
+	tgl->vert_cache = cache;
+
+	unsigned i, j;
+	unsigned n_tris = mesh->n_triangles;
+	if (object_cull) {
+		unsigned n_verts;
+		if (itgl_gather_front_faces(tgl, mesh, eye, &n_verts, &n_tris))
+			return -1;
 
-#ifdef TERMGLUTIL
+		/* Vertex shader, once per vertex of a front face */
+		vert_shader((const TGLVec3 *)tgl->vert_gather, cache, n_verts, vert_data);
+	} else {
+		/* Vertex shader, once per unique vertex */
+		vert_shader(mesh->verts, cache, mesh->n_verts, vert_data);
+	}
 
-#ifdef __unix__
-#include <sys/ioctl.h>
-#include <termios.h>
-#include <unistd.h>
+#ifndef TERMGL_MINIMAL
+	/* Gouraud shading, with the light of each vertex interpolated as u */
+	const uint8_t *light = NULL;
+	if (tgl->lighting && !tgl->texture && mesh->vert_normals) {
+		light = itgl_light_verts(tgl, mesh, object_cull ? tgl->vert_remap : NULL);
+		if (!light)
+			return -1;
+		frag_shader = &tgl_pixel_shader_simple;
+		frag_data = &tgl->lighting->shade;
+	}
 #endif
 
-#ifdef __unix__
-static inline uint8_t itgl_xterm_button_conv(uint8_t button);
+	/* Primitive assembly */
+	uint8_t uv[3][2] = { { 0 } };
+	for (i = 0; i < n_tris; i++) {
+		const unsigned tri = object_cull ? tgl->tri_visible[i] : i;
+		const unsigned *const idx = &mesh->indices[3 * tri];
+		TGLVec4 verts[3];
+		TGLTriangle obj;
+		for (j = 0; j < 3; j++) {
+			const unsigned vert = object_cull ? tgl->vert_remap[idx[j]] : idx[j];
+			memcpy(verts[j], cache[vert], sizeof(TGLVec4));
+			if (mesh->uvs)
+				memcpy(uv[j], mesh->uvs[idx[j]], sizeof(uint8_t[2]));
+#ifndef TERMGL_MINIMAL
+			if (light) {
+				uv[j][0] = light[vert];
+				uv[j][1] = 0;
+			}
+#endif
+			if (tgl->prim_shader)
+				memcpy(obj[j], mesh->verts[idx[j]], sizeof(TGLVec3));
+		}
+		itgl_triangle(tgl, (const TGLVec4 *)verts, (const TGLVec3 *)obj,
+			(const uint8_t(*)[2])uv, fill, !object_cull, frag_shader, frag_data);
+	}
+	return 0;
+}
 
-uint8_t itgl_xterm_button_conv(const uint8_t button)
+int tgl_triangles_3d_varyings(TGL *const tgl, const TGLTriangle *const in, const unsigned count,
+	const unsigned n_varyings, TGLVertexShaderVaryings *const vert_shader,
+	const void *const vert_data, TGLPixelShaderVaryings *const frag_shader,
+	const void *const frag_data)
 {
-	const uint8_t mod = (button & 0x40) ? TGL_MOUSE_WHEEL_OR_MOVEMENT : 0x00;
-	switch ((button - 32) & 0x03) {
-	case 0x00:
-		return TGL_MOUSE_1 | mod;
-	case 0x01:
-		return TGL_MOUSE_3 | mod;
-	case 0x02:
-		return TGL_MOUSE_2 | mod;
-	case 0x03:
-		return TGL_MOUSE_RELEASE | mod;
+	if (n_varyings > TGL_MAX_VARYINGS) {
+		errno = EINVAL;
+		return -1;
+	}
+	enum { BLOCK = 64 };
+	TGLVec4 verts[BLOCK][3];
+	float varyings[BLOCK * 3 * TGL_MAX_VARYINGS];
+	unsigned i;
+	for (i = 0; i < count; i += BLOCK) {
+		const unsigned n = MIN(count - i, (unsigned)BLOCK);
+		vert_shader(in[i], verts[0], varyings, 3 * n, vert_data);
+		unsigned j;
+		for (j = 0; j < n; j++) {
+			const float *const trig_varyings[3] = {
+				&varyings[(3 * j) * n_varyings],
+				&varyings[(3 * j + 1) * n_varyings],
+				&varyings[(3 * j + 2) * n_varyings],
+			};
+			itgl_triangle_varyings(tgl, (const TGLVec4 *)verts[j], trig_varyings,
+				n_varyings, true, frag_shader, frag_data);
+		}
 	}
-	TGL_UNREACHABLE();
 	return 0;
 }
-#endif /* __unix__ */
 
-#ifdef TGL_OS_WINDOWS
-static inline uint8_t itgl_windows_mouse_event_record_conv(
-	MOUSE_EVENT_RECORD record, uint8_t *state);
+int tgl_draw_mesh_varyings(TGL *const tgl, const TGLMesh *const mesh, const unsigned n_varyings,
+	TGLVertexShaderVaryings *const vert_shader, const void *const vert_data,
+	TGLPixelShaderVaryings *const frag_shader, const void *const frag_data)
+{
+	if (n_varyings > TGL_MAX_VARYINGS) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!mesh->n_triangles)
+		return 0;
+	const bool object_cull =
+		tgl->cull_eye_enabled && mesh->normals && (tgl->settings & TGL_CULL_FACE);
+	TGLVec4 *const cache =
+		reserve(tgl->vert_cache, &tgl->vert_cache_capacity, sizeof(TGLVec4), mesh->n_verts);
+	if (!cache)
+		return -1;
+	tgl->vert_cache = cache;
+	float *const varyings = reserve(tgl->vert_varyings, &tgl->vert_varyings_capacity,
+		sizeof(float), mesh->n_verts * n_varyings);
+	if (!varyings && n_varyings)
+		return -1;
+	tgl->vert_varyings = varyings;
+
+	unsigned i, j;
+	unsigned n_tris = mesh->n_triangles;
+	if (object_cull) {
+		unsigned n_verts;
+		if (itgl_gather_front_faces(tgl, mesh, tgl->cull_eye, &n_verts, &n_tris))
+			return -1;
+		vert_shader((const TGLVec3 *)tgl->vert_gather, cache, varyings, n_verts, vert_data);
+	} else {
+		vert_shader(mesh->verts, cache, varyings, mesh->n_verts, vert_data);
+	}
 
-uint8_t itgl_windows_mouse_event_record_conv(const MOUSE_EVENT_RECORD record, uint8_t *const state)
+	for (i = 0; i < n_tris; i++) {
+		const unsigned *const idx =
+			&mesh->indices[3 * (object_cull ? tgl->tri_visible[i] : i)];
+		TGLVec4 verts[3];
+		const float *trig_varyings[3];
+		for (j = 0; j < 3; j++) {
+			const unsigned vert = object_cull ? tgl->vert_remap[idx[j]] : idx[j];
+			memcpy(verts[j], cache[vert], sizeof(TGLVec4));
+			trig_varyings[j] = &varyings[vert * n_varyings];
+		}
+		itgl_triangle_varyings(tgl, (const TGLVec4 *)verts, trig_varyings, n_varyings,
+			!object_cull, frag_shader, frag_data);
+	}
+	return 0;
+}
+
+/* Finds the homogeneous position of the eye in the space mat transforms from, which is projected
+ * to x = y = w = 0. Its sign is not normalized, as that would flip the result of itgl_back_face
+ * for mirroring matrices, whereas this sign makes it agree with the winding of triangles on
+ * screen */
+void itgl_eye(const TGLMat mat, TGLVec4 eye)
 {
-	if (record.dwEventFlags & (MOUSE_WHEELED | 0x0008 | MOUSE_MOVED))
-		return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
-	const uint8_t changed = *state ^ record.dwButtonState;
-	if (changed & *state) {
-		*state = record.dwButtonState;
-		return TGL_MOUSE_RELEASE;
+	const float *const rows[3] = { mat[0], mat[1], mat[3] };
+	unsigned i;
+	for (i = 0; i < 4; i++) {
+		/* Cofactor of column i */
+		const unsigned c0 = i > 0 ? 0 : 1;
+		const unsigned c1 = i > 1 ? 1 : 2;
+		const unsigned c2 = i > 2 ? 2 : 3;
+		const float det =
+			rows[0][c0] * (rows[1][c1] * rows[2][c2] - rows[1][c2] * rows[2][c1])
+			- rows[0][c1] * (rows[1][c0] * rows[2][c2] - rows[1][c2] * rows[2][c0])
+			+ rows[0][c2] * (rows[1][c0] * rows[2][c1] - rows[1][c1] * rows[2][c0]);
+		eye[i] = (i & 1) ? det : -det;
 	}
-	*state = record.dwButtonState;
-	if (changed & 0x01)
-		return TGL_MOUSE_1;
-	if (changed & 0x02)
-		return TGL_MOUSE_2;
-	if (changed & 0x04)
-		return TGL_MOUSE_3;
-	return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
 }
-#endif /* TGL_OS_WINDOWS */
 
-TGL_SSIZE_T tglutil_read(char *const buf, const size_t count, TGLMouseEvent *const event_buf,
-	const size_t count_events, size_t *const count_read_events)
+/* Checks if a triangle should be culled based on which side of its plane the eye lies on */
+bool itgl_back_face(
+	const TGL *const tgl, const TGLVec4 eye, const TGLVec3 normal, const TGLVec3 vert)
 {
-#ifdef __unix__
-	struct termios oldt, newt;
+	const float d = normal[0] * (eye[0] - vert[0] * eye[3])
+		+ normal[1] * (eye[1] - vert[1] * eye[3])
+		+ normal[2] * (eye[2] - vert[2] * eye[3]);
+	return XOR(tgl->settings & TGL_CULL_BIT, d > 0.f);
+}
 
-	/* Disable canonical mode */
-	CALL(tcgetattr(STDIN_FILENO, &oldt), -2);
-	newt = oldt;
-	newt.c_lflag &= ~(ICANON);
-	newt.c_cc[VMIN] = 0;
-	newt.c_cc[VTIME] = 0;
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &newt), -3);
+void tgl_cull_matrix(TGL *const tgl, const TGLMat mat)
+{
+	tgl->cull_eye_enabled = mat != NULL;
+	if (mat)
+		itgl_eye(mat, tgl->cull_eye);
+}
 
-	const TGL_SSIZE_T retval = read(2, buf, count);
+void tgl_mesh_bounds(TGLMesh *const mesh)
+{
+	if (!mesh->n_verts) {
+		memset(mesh->aabb, 0, sizeof(mesh->aabb));
+		return;
+	}
+	memcpy(mesh->aabb[0], mesh->verts[0], sizeof(TGLVec3));
+	memcpy(mesh->aabb[1], mesh->verts[0], sizeof(TGLVec3));
+	unsigned i, j;
+	for (i = 1; i < mesh->n_verts; i++) {
+		for (j = 0; j < 3; j++) {
+			mesh->aabb[0][j] = MIN(mesh->aabb[0][j], mesh->verts[i][j]);
+			mesh->aabb[1][j] = MAX(mesh->aabb[1][j], mesh->verts[i][j]);
+		}
+	}
+}
 
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &oldt), -3);
+#ifndef TERMGL_MINIMAL
+/* Transforms the corners of a box into Clip Space, returning the planes of the view volume all of
+ * them lie outside of */
+unsigned itgl_aabb_corners(const TGLMat mat, const TGLVec3 aabb[2], TGLVec4 corners[8])
+{
+	unsigned code = OUT_VIEW_VOLUME;
+	unsigned i;
+	for (i = 0; i < 8; i++) {
+		const TGLVec3 corner = {
+			aabb[i & 1][0],
+			aabb[(i >> 1) & 1][1],
+			aabb[(i >> 2) & 1][2],
+		};
+		tgl_mulmatvec(mat, corner, corners[i]);
+		code &= itgl_outcode(corners[i]);
+	}
+	return code;
+}
 
-	/* Flush input buffer to prevent read of previous unread input */
-	CALL(tcflush(STDIN_FILENO, TCIFLUSH), -4);
+bool tgl_aabb_visible(const TGLVec3 aabb[2], const TGLMat mat)
+{
+	TGLVec4 corners[8];
+	return !itgl_aabb_corners(mat, aabb, corners);
+}
 
-	if (!event_buf || retval <= 0)
-		return retval;
+bool tgl_mesh_visible(const TGLMesh *const mesh, const TGLMat mat)
+{
+	return tgl_aabb_visible((const TGLVec3 *)mesh->aabb, mat);
+}
 
-	/* Parse mouse events */
-	*count_read_events = 0;
-	size_t rd, wr = 0;
-	for (rd = 0; rd < (size_t)retval; rd++) {
-		if (buf[rd] == '\033' && buf[rd + 1] == '[' && buf[rd + 2] == 'M') {
-			if (*count_read_events < count_events
-				&& ((buf[rd + 3] & 0x7f) == buf[rd + 3]))
-				event_buf[(*count_read_events)++] = (TGLMouseEvent){
-					.button = itgl_xterm_button_conv(buf[rd + 3]),
-					.x = buf[rd + 4] - 32,
-					.y = buf[rd + 5] - 32,
-				};
-			rd += 5;
-			continue;
+/* Computes the intensity of the light received by a vertex, mapped onto [0, 255] */
+uint8_t itgl_vertex_light(
+	const TGLLighting *const lighting, const TGLVec3 vert, const TGLVec3 normal)
+{
+	float intensity = lighting->ambient;
+	unsigned i;
+	for (i = 0; i < lighting->n_lights; i++) {
+		const TGLLight *const l = &lighting->lights[i];
+		float d;
+		if (l->point) {
+			TGLVec3 dir;
+			tgl_sub3v(l->vec, vert, dir);
+			d = tgl_dot3(normal, dir);
+			if (d > 0.f)
+				d /= tgl_mag3(dir);
+		} else {
+			d = -tgl_dot3(normal, l->vec);
+		}
+		if (d > 0.f)
+			intensity += l->intensity * d;
+	}
+	return (uint8_t)(MAX(MIN(intensity, 1.f), 0.f) * 255.f);
+}
+
+/* Lights the vertices of a mesh, or only those which remap maps into vert_cache if it is not NULL
+ * @return light of each vertex in vert_cache, NULL on failure
+ **/
+const uint8_t *itgl_light_verts(
+	TGL *const tgl, const TGLMesh *const mesh, const unsigned *const remap)
+{
+	uint8_t *const light =
+		reserve(tgl->vert_light, &tgl->vert_light_capacity, sizeof(uint8_t), mesh->n_verts);
+	if (!light)
+		return NULL;
+	tgl->vert_light = light;
+	unsigned i;
+	for (i = 0; i < mesh->n_verts; i++) {
+		if (remap && remap[i] == UINT_MAX)
+			continue;
+		light[remap ? remap[i] : i] =
+			itgl_vertex_light(tgl->lighting, mesh->verts[i], mesh->vert_normals[i]);
+	}
+	return light;
+}
+
+void tgl_lighting(TGL *const tgl, const TGLLighting *const lighting)
+{
+	tgl->lighting = lighting;
+}
+
+void tgl_mesh_vertex_normals(const TGLMesh *const mesh, TGLVec3 *const normals)
+{
+	memset(normals, 0, sizeof(TGLVec3) * mesh->n_verts);
+	unsigned i, j;
+	for (i = 0; i < mesh->n_triangles; i++) {
+		const unsigned *const idx = &mesh->indices[3 * i];
+		TGLVec3 ab, ac, cp;
+		tgl_sub3v(mesh->verts[idx[1]], mesh->verts[idx[0]], ab);
+		tgl_sub3v(mesh->verts[idx[2]], mesh->verts[idx[0]], ac);
+		tgl_cross(ab, ac, cp);
+		for (j = 0; j < 3; j++)
+			tgl_add3v(normals[idx[j]], cp, normals[idx[j]]);
+	}
+	for (i = 0; i < mesh->n_verts; i++)
+		if (tgl_magsqr3(normals[i]) > 0.f)
+			tgl_norm3(normals[i]);
+}
+
+/* Halves the resolution of a texture level, keeping the most common texel of each block of up to
+ * 2x2 texels */
+void itgl_texture_downsample(const TextureLevel *const src, const unsigned src_width,
+	const unsigned src_height, char *const chars, TGLPixFmt *const colors, const unsigned width,
+	const unsigned height)
+{
+	unsigned x, y, i, j;
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			const unsigned sx = MIN(2 * x, src_width - 1);
+			const unsigned sx1 = MIN(2 * x + 1, src_width - 1);
+			const unsigned sy = MIN(2 * y, src_height - 1);
+			const unsigned sy1 = MIN(2 * y + 1, src_height - 1);
+			const unsigned block[4] = {
+				sy * src_width + sx,
+				sy * src_width + sx1,
+				sy1 * src_width + sx,
+				sy1 * src_width + sx1,
+			};
+			unsigned best = block[0], best_count = 0;
+			for (i = 0; i < 4; i++) {
+				unsigned count = 0;
+				for (j = 0; j < 4; j++)
+					count += src->chars[block[i]] == src->chars[block[j]]
+						&& pixfmt_identical(src->colors[block[i]],
+							src->colors[block[j]]);
+				if (count > best_count) {
+					best = block[i];
+					best_count = count;
+				}
+			}
+			chars[y * width + x] = src->chars[best];
+			colors[y * width + x] = src->colors[best];
+		}
+	}
+}
+
+TGLTexture *tgl_texture_create(const unsigned width, const unsigned height,
+	const char *const chars, const TGLPixFmt *const colors)
+{
+	if (!width || width > 256 || (width & (width - 1)) || !height || height > 256
+		|| (height & (height - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	unsigned log2_width = 0, log2_height = 0;
+	while ((1U << log2_width) < width)
+		log2_width++;
+	while ((1U << log2_height) < height)
+		log2_height++;
+
+	const unsigned n_levels = MAX(log2_width, log2_height) + 1;
+	unsigned n_texels = 0;
+	unsigned i;
+	for (i = 0; i < n_levels; i++)
+		n_texels += (width >> MIN(i, log2_width)) * (height >> MIN(i, log2_height));
+
+	TGLTexture *const texture =
+		TGL_MALLOC(sizeof(TGLTexture) + sizeof(TextureLevel) * n_levels);
+	char *const level_chars = TGL_MALLOC(n_texels);
+	TGLPixFmt *const level_colors = TGL_MALLOC(sizeof(TGLPixFmt) * n_texels);
+	if (!texture || !level_chars || !level_colors) {
+		TGL_FREE(texture);
+		TGL_FREE(level_chars);
+		TGL_FREE(level_colors);
+		return NULL;
+	}
+	*texture = (TGLTexture){
+		.n_levels = n_levels,
+		.texel_area = (float)(width * height) / 65536.f,
+		.levels = (TextureLevel *)(texture + 1),
+	};
+	memcpy(level_chars, chars, width * height);
+	memcpy(level_colors, colors, sizeof(TGLPixFmt) * width * height);
+
+	unsigned offset = 0;
+	for (i = 0; i < n_levels; i++) {
+		const unsigned log2_w = log2_width - MIN(i, log2_width);
+		const unsigned log2_h = log2_height - MIN(i, log2_height);
+		texture->levels[i] = (TextureLevel){
+			.chars = &level_chars[offset],
+			.colors = &level_colors[offset],
+			.shift_u = 8 - log2_w,
+			.shift_v = 8 - log2_h,
+			.log2_width = log2_w,
+		};
+		if (i)
+			itgl_texture_downsample(&texture->levels[i - 1],
+				1U << texture->levels[i - 1].log2_width,
+				1U << (8 - texture->levels[i - 1].shift_v), &level_chars[offset],
+				&level_colors[offset], 1U << log2_w, 1U << log2_h);
+		offset += 1U << (log2_w + log2_h);
+	}
+	return texture;
+}
+
+void tgl_texture_delete(TGLTexture *const texture)
+{
+	TGL_FREE((void *)texture->levels[0].chars);
+	TGL_FREE((void *)texture->levels[0].colors);
+	TGL_FREE(texture);
+}
+
+void tgl_texture(TGL *const tgl, const TGLTexture *const texture)
+{
+	tgl->texture = texture;
+}
+
+/* Selects the mip level of a texture whose texels are closest in size to the cells covered by a
+ * triangle */
+const TextureLevel *itgl_texture_level(const TGL *const tgl, const TGLTexture *const texture,
+	const TGLVec4 verts[3], const uint8_t (*const uv)[2])
+{
+	const float half_width = tgl->width * .5f;
+	const float half_height = tgl->height * .5f;
+	float x[3], y[3];
+	unsigned i;
+	for (i = 0; i < 3; i++) {
+		/* Triangles crossing the plane of the eye are close enough for the finest level */
+		if (verts[i][3] <= 0.f)
+			return &texture->levels[0];
+		const float inv_w = 1.f / verts[i][3];
+		x[i] = MAP_COORD(half_width, verts[i][0] * inv_w);
+		y[i] = MAP_COORD(half_height, verts[i][1] * inv_w);
+	}
+	const float cells = fabsf((x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]));
+	const float texels = texture->texel_area
+		* fabsf((float)(uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1])
+			- (float)(uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]));
+	if (!(texels > cells))
+		return &texture->levels[0];
+
+	/* Each level halves the width and height of texels */
+	const unsigned level = (unsigned)(.5f * log2f(texels / cells) + .5f);
+	return &texture->levels[MIN(level, texture->n_levels - 1)];
+}
+
+void itgl_pixel_shader_texture_level(const uint8_t u, const uint8_t v, TGLPixFmt *const color,
+	char *const c, const void *const data)
+{
+	const TextureLevel *const level = data;
+	const unsigned idx =
+		((unsigned)(v >> level->shift_v) << level->log2_width) | (u >> level->shift_u);
+	*color = level->colors[idx];
+	*c = level->chars[idx];
+}
+
+void itgl_aabb_union(TGLVec3 aabb[2], const TGLVec3 other[2])
+{
+	unsigned i;
+	for (i = 0; i < 3; i++) {
+		aabb[0][i] = MIN(aabb[0][i], other[0][i]);
+		aabb[1][i] = MAX(aabb[1][i], other[1][i]);
+	}
+}
+
+void itgl_scene_tri_bounds(const TGLMesh *const meshes, const SceneTri *const tri, TGLVec3 aabb[2])
+{
+	const TGLMesh *const mesh = &meshes[tri->mesh];
+	const unsigned *const idx = &mesh->indices[3 * tri->idx];
+	memcpy(aabb[0], mesh->verts[idx[0]], sizeof(TGLVec3));
+	memcpy(aabb[1], mesh->verts[idx[0]], sizeof(TGLVec3));
+	unsigned i, j;
+	for (i = 1; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			aabb[0][j] = MIN(aabb[0][j], mesh->verts[idx[i]][j]);
+			aabb[1][j] = MAX(aabb[1][j], mesh->verts[idx[i]][j]);
+		}
+	}
+}
+
+/* Partially sorts tris[lo, hi) by centroid along axis, such that tris[k] is in its sorted
+ * position */
+void itgl_scene_select(
+	SceneTri *const tris, unsigned lo, unsigned hi, const unsigned k, const unsigned axis)
+{
+	while (hi - lo > 1) {
+		const float pivot = tris[lo + (hi - lo - 1) / 2].centroid[axis];
+		unsigned i = lo, j = hi - 1;
+		for (;;) {
+			while (tris[i].centroid[axis] < pivot)
+				i++;
+			while (tris[j].centroid[axis] > pivot)
+				j--;
+			if (i >= j)
+				break;
+			const SceneTri tmp = tris[i];
+			tris[i++] = tris[j];
+			tris[j--] = tmp;
+		}
+		/* tris[lo, j] <= pivot <= tris[j + 1, hi) */
+		if (k <= j)
+			hi = j + 1;
+		else
+			lo = j + 1;
+	}
+}
+
+/* Copies the triangles tris[first, first + n_tris) into the scene, along with the vertices they
+ * use */
+int itgl_scene_leaf(TGLScene *const scene, const TGLMesh *const meshes,
+	const unsigned *const vert_offsets, unsigned *const remap, const SceneTri *const tris,
+	const unsigned first, const unsigned n_tris, SceneNode *const node)
+{
+	TGLVec3 *const verts = reserve(scene->verts, &scene->verts_capacity, sizeof(TGLVec3),
+		scene->n_verts + 3 * n_tris);
+	if (!verts)
+		return -1;
+	scene->verts = verts;
+	if (scene->has_uvs) {
+		uint8_t(*const uvs)[2] = reserve(scene->uvs, &scene->uvs_capacity,
+			sizeof(uint8_t[2]), scene->n_verts + 3 * n_tris);
+		if (!uvs)
+			return -1;
+		scene->uvs = uvs;
+	}
+	if (scene->has_vert_normals) {
+		TGLVec3 *const vert_normals = reserve(scene->vert_normals,
+			&scene->vert_normals_capacity, sizeof(TGLVec3),
+			scene->n_verts + 3 * n_tris);
+		if (!vert_normals)
+			return -1;
+		scene->vert_normals = vert_normals;
+	}
+
+	node->child = first;
+	node->n_tris = n_tris;
+	node->first_vert = scene->n_verts;
+	node->n_verts = 0;
+	unsigned i, j;
+	for (i = first; i < first + n_tris; i++) {
+		const TGLMesh *const mesh = &meshes[tris[i].mesh];
+		const unsigned *const idx = &mesh->indices[3 * tris[i].idx];
+		for (j = 0; j < 3; j++) {
+			unsigned *const local = &remap[vert_offsets[tris[i].mesh] + idx[j]];
+			if (*local == UINT_MAX) {
+				*local = node->n_verts++;
+				memcpy(scene->verts[scene->n_verts], mesh->verts[idx[j]],
+					sizeof(TGLVec3));
+				if (mesh->uvs)
+					memcpy(scene->uvs[scene->n_verts], mesh->uvs[idx[j]],
+						sizeof(uint8_t[2]));
+				else if (scene->has_uvs)
+					memset(scene->uvs[scene->n_verts], 0, sizeof(uint8_t[2]));
+				if (mesh->vert_normals)
+					memcpy(scene->vert_normals[scene->n_verts],
+						mesh->vert_normals[idx[j]], sizeof(TGLVec3));
+				else if (scene->has_vert_normals)
+					memset(scene->vert_normals[scene->n_verts], 0,
+						sizeof(TGLVec3));
+				scene->n_verts++;
+			}
+			scene->indices[3 * i + j] = *local;
+		}
+		if (mesh->normals) {
+			memcpy(scene->normals[i], mesh->normals[tris[i].idx], sizeof(TGLVec3));
+		} else {
+			TGLVec3 ab, ac;
+			tgl_sub3v(mesh->verts[idx[1]], mesh->verts[idx[0]], ab);
+			tgl_sub3v(mesh->verts[idx[2]], mesh->verts[idx[0]], ac);
+			tgl_cross(ab, ac, scene->normals[i]);
+		}
+	}
+
+	/* Vertices shared with other leaves are duplicated */
+	for (i = first; i < first + n_tris; i++) {
+		const unsigned *const idx = &meshes[tris[i].mesh].indices[3 * tris[i].idx];
+		for (j = 0; j < 3; j++)
+			remap[vert_offsets[tris[i].mesh] + idx[j]] = UINT_MAX;
+	}
+	return 0;
+}
+
+/* Builds the subtree of node node_idx over tris[first, first + n_tris), splitting at the median
+ * centroid along the longest axis */
+int itgl_scene_build(TGLScene *const scene, const TGLMesh *const meshes,
+	const unsigned *const vert_offsets, unsigned *const remap, SceneTri *const tris,
+	const unsigned first, const unsigned n_tris, const unsigned node_idx)
+{
+	SceneNode *node = &scene->nodes[node_idx];
+	if (n_tris <= SCENE_LEAF_SIZE) {
+		TGLVec3 aabb[2];
+		unsigned i;
+		itgl_scene_tri_bounds(meshes, &tris[first], node->aabb);
+		for (i = first + 1; i < first + n_tris; i++) {
+			itgl_scene_tri_bounds(meshes, &tris[i], aabb);
+			itgl_aabb_union(node->aabb, (const TGLVec3 *)aabb);
+		}
+		return itgl_scene_leaf(
+			scene, meshes, vert_offsets, remap, tris, first, n_tris, node);
+	}
+
+	TGLVec3 extent[2];
+	unsigned i;
+	memcpy(extent[0], tris[first].centroid, sizeof(TGLVec3));
+	memcpy(extent[1], tris[first].centroid, sizeof(TGLVec3));
+	unsigned j;
+	for (i = first + 1; i < first + n_tris; i++) {
+		for (j = 0; j < 3; j++) {
+			extent[0][j] = MIN(extent[0][j], tris[i].centroid[j]);
+			extent[1][j] = MAX(extent[1][j], tris[i].centroid[j]);
+		}
+	}
+	unsigned axis = 0;
+	for (i = 1; i < 3; i++)
+		if (extent[1][i] - extent[0][i] > extent[1][axis] - extent[0][axis])
+			axis = i;
+	const unsigned n_left = n_tris / 2;
+	itgl_scene_select(tris, first, first + n_tris, first + n_left, axis);
+
+	SceneNode *const nodes = reserve(
+		scene->nodes, &scene->nodes_capacity, sizeof(SceneNode), scene->n_nodes + 2);
+	if (!nodes)
+		return -1;
+	scene->nodes = nodes;
+	const unsigned child = scene->n_nodes;
+	scene->n_nodes += 2;
+	scene->nodes[node_idx] = (SceneNode){
+		.child = child,
+	};
+	if (itgl_scene_build(scene, meshes, vert_offsets, remap, tris, first, n_left, child)
+		|| itgl_scene_build(scene, meshes, vert_offsets, remap, tris, first + n_left,
+			n_tris - n_left, child + 1))
+		return -1;
+
+	/* Nodes may have been moved by the children's construction */
+	node = &scene->nodes[node_idx];
+	memcpy(node->aabb, scene->nodes[child].aabb, sizeof(node->aabb));
+	itgl_aabb_union(node->aabb, (const TGLVec3 *)scene->nodes[child + 1].aabb);
+	return 0;
+}
+
+TGLScene *tgl_scene_create(const TGLMesh *const meshes, const unsigned count)
+{
+	TGLScene *const scene = TGL_MALLOC(sizeof(TGLScene));
+	if (!scene)
+		return NULL;
+	*scene = (TGLScene){ 0 };
+
+	unsigned n_tris = 0, n_verts = 0;
+	unsigned i, j;
+	for (i = 0; i < count; i++) {
+		n_tris += meshes[i].n_triangles;
+		n_verts += meshes[i].n_verts;
+		scene->has_uvs |= meshes[i].uvs != NULL;
+		scene->has_vert_normals |= meshes[i].vert_normals != NULL;
+	}
+
+	unsigned *const vert_offsets = TGL_MALLOC(sizeof(unsigned) * count);
+	unsigned *const remap = TGL_MALLOC(sizeof(unsigned) * n_verts);
+	SceneTri *const tris = TGL_MALLOC(sizeof(SceneTri) * n_tris);
+	scene->indices = TGL_MALLOC(sizeof(unsigned[3]) * n_tris);
+	scene->normals = TGL_MALLOC(sizeof(TGLVec3) * n_tris);
+	scene->nodes = reserve(NULL, &scene->nodes_capacity, sizeof(SceneNode), 1);
+	/* Scenes without triangles are valid, and malloc may return NULL for 0 bytes */
+	if ((count && !vert_offsets) || (n_verts && !remap)
+		|| (n_tris && (!tris || !scene->indices || !scene->normals)) || !scene->nodes)
+		goto err;
+
+	unsigned n = 0;
+	n_verts = 0;
+	for (i = 0; i < count; i++) {
+		vert_offsets[i] = n_verts;
+		n_verts += meshes[i].n_verts;
+		for (j = 0; j < meshes[i].n_triangles; j++) {
+			TGLVec3 aabb[2];
+			tris[n] = (SceneTri){
+				.mesh = i,
+				.idx = j,
+			};
+			itgl_scene_tri_bounds(meshes, &tris[n], aabb);
+			tgl_add3v(aabb[0], aabb[1], tris[n].centroid);
+			tgl_mul3s(tris[n].centroid, .5f, tris[n].centroid);
+			n++;
+		}
+	}
+	for (i = 0; i < n_verts; i++)
+		remap[i] = UINT_MAX;
+
+	scene->n_nodes = 1;
+	if (n_tris) {
+		if (itgl_scene_build(scene, meshes, vert_offsets, remap, tris, 0, n_tris, 0))
+			goto err;
+	} else {
+		scene->nodes[0] = (SceneNode){ 0 };
+	}
+
+	TGL_FREE(vert_offsets);
+	TGL_FREE(remap);
+	TGL_FREE(tris);
+	return scene;
+
+err:
+	TGL_FREE(vert_offsets);
+	TGL_FREE(remap);
+	TGL_FREE(tris);
+	tgl_scene_delete(scene);
+	return NULL;
+}
+
+void tgl_scene_delete(TGLScene *const scene)
+{
+	TGL_FREE(scene->nodes);
+	TGL_FREE(scene->verts);
+	TGL_FREE(scene->uvs);
+	TGL_FREE(scene->vert_normals);
+	TGL_FREE(scene->indices);
+	TGL_FREE(scene->normals);
+	TGL_FREE(scene);
+}
+
+/* Draws the visible leaves of a subtree, visiting the child nearest to the camera first so that it
+ * can occlude the other */
+int itgl_scene_draw_node(TGL *const tgl, const TGLScene *const scene, const unsigned node_idx,
+	const TGLMat mat, const TGLVec4 eye, const bool fill,
+	TGLVertexShaderBatch *const vert_shader, const void *const vert_data,
+	TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	const SceneNode *const node = &scene->nodes[node_idx];
+	TGLVec4 corners[8];
+	if (itgl_aabb_corners(mat, (const TGLVec3 *)node->aabb, corners)
+		|| (hiz_enabled(tgl) && itgl_hiz_reject(tgl, (const TGLVec4 *)corners, 8)))
+		return 0;
+
+	if (node->n_tris) {
+		const TGLMesh leaf = {
+			.verts = (const TGLVec3 *)&scene->verts[node->first_vert],
+			.uvs = scene->has_uvs
+				? (const uint8_t(*)[2])&scene->uvs[node->first_vert]
+				: NULL,
+			.vert_normals = scene->has_vert_normals
+				? (const TGLVec3 *)&scene->vert_normals[node->first_vert]
+				: NULL,
+			.indices = &scene->indices[3 * node->child],
+			.normals = (const TGLVec3 *)&scene->normals[node->child],
+			.n_verts = node->n_verts,
+			.n_triangles = node->n_tris,
+		};
+		return itgl_draw_mesh(
+			tgl, &leaf, eye, fill, vert_shader, vert_data, frag_shader, frag_data);
+	}
+
+	/* Larger depth is nearer */
+	float depth[2];
+	unsigned i;
+	for (i = 0; i < 2; i++) {
+		const SceneNode *const child = &scene->nodes[node->child + i];
+		TGLVec3 center;
+		tgl_add3v(child->aabb[0], child->aabb[1], center);
+		tgl_mul3s(center, .5f, center);
+		TGLVec4 v;
+		tgl_mulmatvec(mat, center, v);
+		depth[i] = v[3] > 0.f ? v[2] / v[3] : -INFINITY;
+	}
+	const unsigned nearer = depth[1] > depth[0];
+	return itgl_scene_draw_node(tgl, scene, node->child + nearer, mat, eye, fill,
+		       vert_shader, vert_data, frag_shader, frag_data)
+		|| itgl_scene_draw_node(tgl, scene, node->child + !nearer, mat, eye, fill,
+			vert_shader, vert_data, frag_shader, frag_data);
+}
+
+int tgl_scene_draw(TGL *const tgl, const TGLScene *const scene, const TGLMat mat, const bool fill,
+	TGLVertexShaderBatch *const vert_shader, const void *const vert_data,
+	TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	if (!scene->nodes[0].n_tris && !scene->nodes[0].child)
+		return 0;
+	TGLVec4 eye;
+	itgl_eye(mat, eye);
+	return itgl_scene_draw_node(
+		tgl, scene, 0, mat, eye, fill, vert_shader, vert_data, frag_shader, frag_data)
+		? -1
+		: 0;
+}
+
+int itgl_lod_key_cmp(const void *const a, const void *const b)
+{
+	const uint64_t ka = ((const LODKey *)a)->key, kb = ((const LODKey *)b)->key;
+	return (ka > kb) - (ka < kb);
+}
+
+/* Simplifies a mesh by merging all vertices within each cell of a res^3 grid spanning its
+ * bounding box */
+int itgl_lod_level(const TGLMesh *const mesh, const unsigned res, LODKey *const keys,
+	unsigned *const cluster, TGLMesh *const out)
+{
+	float extent = 0.f;
+	unsigned i, j;
+	for (i = 0; i < 3; i++)
+		extent = MAX(extent, mesh->aabb[1][i] - mesh->aabb[0][i]);
+	const float inv_cell = extent > 0.f ? res / extent : 0.f;
+
+	for (i = 0; i < mesh->n_verts; i++) {
+		uint64_t key = 0;
+		for (j = 0; j < 3; j++) {
+			const unsigned c =
+				(unsigned)((mesh->verts[i][j] - mesh->aabb[0][j]) * inv_cell);
+			key |= (uint64_t)MIN(c, res - 1) << (16 * j);
+		}
+		keys[i] = (LODKey){
+			.key = key,
+			.vert = i,
+		};
+	}
+	qsort(keys, mesh->n_verts, sizeof(LODKey), &itgl_lod_key_cmp);
+	unsigned n_verts = 0;
+	for (i = 0; i < mesh->n_verts; i++) {
+		if (i && keys[i].key != keys[i - 1].key)
+			n_verts++;
+		cluster[keys[i].vert] = n_verts;
+	}
+	n_verts += mesh->n_verts ? 1 : 0;
+
+	unsigned n_tris = 0;
+	for (i = 0; i < mesh->n_triangles; i++) {
+		const unsigned *const idx = &mesh->indices[3 * i];
+		const unsigned c0 = cluster[idx[0]], c1 = cluster[idx[1]], c2 = cluster[idx[2]];
+		n_tris += c0 != c1 && c1 != c2 && c2 != c0;
+	}
+
+	TGLVec3 *const verts = TGL_MALLOC(sizeof(TGLVec3) * n_verts);
+	uint8_t(*const uvs)[2] = mesh->uvs ? TGL_MALLOC(sizeof(uint8_t[2]) * n_verts) : NULL;
+	TGLVec3 *const vert_normals =
+		mesh->vert_normals ? TGL_MALLOC(sizeof(TGLVec3) * n_verts) : NULL;
+	unsigned *const indices = TGL_MALLOC(sizeof(unsigned[3]) * n_tris);
+	TGLVec3 *const normals = mesh->normals ? TGL_MALLOC(sizeof(TGLVec3) * n_tris) : NULL;
+	if (!verts || (mesh->uvs && !uvs) || (mesh->vert_normals && !vert_normals)
+		|| (n_tris && (!indices || (mesh->normals && !normals)))) {
+		TGL_FREE(verts);
+		TGL_FREE(uvs);
+		TGL_FREE(vert_normals);
+		TGL_FREE(indices);
+		TGL_FREE(normals);
+		return -1;
+	}
+
+	/* Each cluster is represented by the mean of its vertices */
+	unsigned first = 0;
+	for (i = 0; i < mesh->n_verts; i++) {
+		if (i + 1 < mesh->n_verts && keys[i + 1].key == keys[i].key)
+			continue;
+		const unsigned c = cluster[keys[i].vert];
+		const float inv_n = 1.f / (i + 1 - first);
+		unsigned uv_sum[2] = { 0, 0 };
+		memset(verts[c], 0, sizeof(TGLVec3));
+		if (vert_normals)
+			memset(vert_normals[c], 0, sizeof(TGLVec3));
+		for (j = first; j <= i; j++) {
+			tgl_add3v(verts[c], mesh->verts[keys[j].vert], verts[c]);
+			if (uvs) {
+				uv_sum[0] += mesh->uvs[keys[j].vert][0];
+				uv_sum[1] += mesh->uvs[keys[j].vert][1];
+			}
+			if (vert_normals)
+				tgl_add3v(vert_normals[c], mesh->vert_normals[keys[j].vert],
+					vert_normals[c]);
+		}
+		tgl_mul3s(verts[c], inv_n, verts[c]);
+		if (vert_normals && tgl_magsqr3(vert_normals[c]) > 0.f)
+			tgl_norm3(vert_normals[c]);
+		if (uvs) {
+			uvs[c][0] = (uint8_t)(uv_sum[0] / (i + 1 - first));
+			uvs[c][1] = (uint8_t)(uv_sum[1] / (i + 1 - first));
+		}
+		first = i + 1;
+	}
+
+	/* Triangles collapsed onto an edge or a point are dropped */
+	n_tris = 0;
+	for (i = 0; i < mesh->n_triangles; i++) {
+		const unsigned *const idx = &mesh->indices[3 * i];
+		const unsigned c0 = cluster[idx[0]], c1 = cluster[idx[1]], c2 = cluster[idx[2]];
+		if (c0 == c1 || c1 == c2 || c2 == c0)
+			continue;
+		indices[3 * n_tris] = c0;
+		indices[3 * n_tris + 1] = c1;
+		indices[3 * n_tris + 2] = c2;
+		if (normals) {
+			TGLVec3 ab, ac;
+			tgl_sub3v(verts[c1], verts[c0], ab);
+			tgl_sub3v(verts[c2], verts[c0], ac);
+			tgl_cross(ab, ac, normals[n_tris]);
+		}
+		n_tris++;
+	}
+
+	*out = (TGLMesh){
+		.verts = (const TGLVec3 *)verts,
+		.uvs = (const uint8_t(*)[2])uvs,
+		.indices = indices,
+		.normals = (const TGLVec3 *)normals,
+		.vert_normals = (const TGLVec3 *)vert_normals,
+		.n_verts = n_verts,
+		.n_triangles = n_tris,
+	};
+	memcpy(out->aabb, mesh->aabb, sizeof(out->aabb));
+	return 0;
+}
+
+TGLMeshLOD *tgl_mesh_lod_create(const TGLMesh *const mesh, unsigned n_levels)
+{
+	n_levels = MAX(n_levels, 1U);
+	TGLMeshLOD *const lod = TGL_MALLOC(sizeof(TGLMeshLOD) + sizeof(LODLevel) * n_levels);
+	LODKey *const keys = TGL_MALLOC(sizeof(LODKey) * mesh->n_verts);
+	unsigned *const cluster = TGL_MALLOC(sizeof(unsigned) * mesh->n_verts);
+	if (!lod || (mesh->n_verts && (!keys || !cluster))) {
+		TGL_FREE(lod);
+		TGL_FREE(keys);
+		TGL_FREE(cluster);
+		return NULL;
+	}
+	*lod = (TGLMeshLOD){
+		.n_levels = 1,
+		.levels = (LODLevel *)(lod + 1),
+	};
+	lod->levels[0] = (LODLevel){
+		.mesh = *mesh,
+		.res = UINT_MAX,
+	};
+	tgl_mesh_bounds(&lod->levels[0].mesh);
+
+	unsigned res = LOD_MAX_RES;
+	for (; lod->n_levels < n_levels && res >= 2 && mesh->n_verts; res /= 2) {
+		LODLevel *const level = &lod->levels[lod->n_levels];
+		if (itgl_lod_level(&lod->levels[0].mesh, res, keys, cluster, &level->mesh)) {
+			TGL_FREE(keys);
+			TGL_FREE(cluster);
+			tgl_mesh_lod_delete(lod);
+			return NULL;
+		}
+		level->res = res;
+		lod->n_levels++;
+	}
+
+	TGL_FREE(keys);
+	TGL_FREE(cluster);
+	return lod;
+}
+
+void tgl_mesh_lod_delete(TGLMeshLOD *const lod)
+{
+	unsigned i;
+	for (i = 1; i < lod->n_levels; i++) {
+		TGL_FREE((void *)lod->levels[i].mesh.verts);
+		TGL_FREE((void *)lod->levels[i].mesh.uvs);
+		TGL_FREE((void *)lod->levels[i].mesh.vert_normals);
+		TGL_FREE((void *)lod->levels[i].mesh.indices);
+		TGL_FREE((void *)lod->levels[i].mesh.normals);
+	}
+	TGL_FREE(lod);
+}
+
+const TGLMesh *tgl_mesh_lod_select(
+	const TGL *const tgl, const TGLMeshLOD *const lod, const TGLMat mat)
+{
+	const TGLMesh *const base = &lod->levels[0].mesh;
+	TGLVec4 corners[8];
+	if (itgl_aabb_corners(mat, (const TGLVec3 *)base->aabb, corners))
+		return NULL;
+
+	/* Size of the bounding box on screen in cells, unknown if it crosses the near plane */
+	float min_x = INFINITY, max_x = -INFINITY, min_y = INFINITY, max_y = -INFINITY;
+	unsigned i;
+	for (i = 0; i < 8; i++) {
+		if (corners[i][3] <= 0.f || itgl_clip_plane_dot(corners[i], CLIP_NEAR) < 0.f)
+			return base;
+		const float inv_w = 1.f / corners[i][3];
+		min_x = MIN(min_x, corners[i][0] * inv_w);
+		max_x = MAX(max_x, corners[i][0] * inv_w);
+		min_y = MIN(min_y, corners[i][1] * inv_w);
+		max_y = MAX(max_y, corners[i][1] * inv_w);
+	}
+	const float size = MAX((max_x - min_x) * tgl->width, (max_y - min_y) * tgl->height) * .5f;
+
+	/* Coarsest level whose merged vertices are less than a cell apart on screen */
+	for (i = lod->n_levels - 1; i > 0; i--)
+		if ((float)lod->levels[i].res >= size)
+			return &lod->levels[i].mesh;
+	return base;
+}
+
+int tgl_mesh_lod_draw(TGL *const tgl, const TGLMeshLOD *const lod, const TGLMat mat,
+	const bool fill, TGLVertexShaderBatch *const vert_shader, const void *const vert_data,
+	TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	const TGLMesh *const mesh = tgl_mesh_lod_select(tgl, lod, mat);
+	if (!mesh)
+		return 0;
+	return tgl_draw_mesh(tgl, mesh, fill, vert_shader, vert_data, frag_shader, frag_data);
+}
+
+int tgl_draw_mesh_instanced(TGL *const tgl, const TGLMesh *const mesh, const TGLMat *const mats,
+	const unsigned count, const bool fill, TGLVertexShaderBatch *const vert_shader,
+	const void *const vert_data, const size_t vert_stride, TGLPixelShader *const frag_shader,
+	const void *const frag_data, const size_t frag_stride)
+{
+	const bool object_cull = mesh->normals && (tgl->settings & TGL_CULL_FACE);
+	TGLVertexShaderSimple simple;
+	unsigned i;
+	for (i = 0; i < count; i++) {
+		/* Per-instance frustum and occlusion culling */
+		TGLVec4 corners[8];
+		if (itgl_aabb_corners(mats[i], (const TGLVec3 *)mesh->aabb, corners)
+			|| (hiz_enabled(tgl) && itgl_hiz_reject(tgl, (const TGLVec4 *)corners, 8)))
+			continue;
+
+		const void *instance_vert_data;
+		if (vert_data) {
+			instance_vert_data = (const char *)vert_data + vert_stride * i;
+		} else {
+			memcpy(simple.mat, mats[i], sizeof(TGLMat));
+			instance_vert_data = &simple;
+		}
+		TGLVec4 eye;
+		if (object_cull)
+			itgl_eye(mats[i], eye);
+		if (itgl_draw_mesh(tgl, mesh, object_cull ? eye : NULL, fill, vert_shader,
+			    instance_vert_data, frag_shader,
+			    frag_data ? (const char *)frag_data + frag_stride * i : NULL))
+			return -1;
+	}
+	return 0;
+}
+#endif /* ~TERMGL_MINIMAL */
+
+/* Checks if a triangle in clip space can be discarded before clipping, as it lies outside the view
+ * volume, faces away, or is hidden by the hierarchical depth buffer
+ * @param clip_planes: set to the planes the triangle must be clipped against if it is kept
+ **/
+bool itgl_reject_triangle(
+	TGL *const tgl, const TGLVec4 verts[3], const bool cull_face, unsigned *const clip_planes)
+{
+	const unsigned out0 = itgl_outcode(verts[0]);
+	const unsigned out1 = itgl_outcode(verts[1]);
+	const unsigned out2 = itgl_outcode(verts[2]);
+
+	/* Trivial rejection if all vertices lie outside the same plane */
+	if (out0 & out1 & out2)
+		return true;
+
+	/* Backface culling */
+	if (cull_face && (tgl->settings & TGL_CULL_FACE)) {
+		TGLVec3 v0s, v1s, v2s, ab, ac, cp;
+		tgl_mul3s(verts[0], 1.f / verts[0][3], v0s);
+		tgl_mul3s(verts[1], 1.f / verts[1][3], v1s);
+		tgl_mul3s(verts[2], 1.f / verts[2][3], v2s);
+		tgl_sub3v(v1s, v0s, ab);
+		tgl_sub3v(v2s, v0s, ac);
+		tgl_cross(ab, ac, cp);
+		if (XOR(tgl->settings & TGL_CULL_BIT, signbit(cp[2])))
+			return true;
+	}
+
+	/* Occlusion culling */
+	if (hiz_enabled(tgl) && itgl_hiz_reject(tgl, verts, 3))
+		return true;
+
+	*clip_planes = (out0 | out1 | out2) & OUT_CLIP_PLANES;
+	return false;
+}
+
+/* Culls, clips, and draws a triangle in clip space */
+void itgl_triangle(TGL *const tgl, const TGLVec4 verts[3], const TGLVec3 *const obj,
+	const uint8_t (*const uv)[2], const bool fill, const bool cull_face,
+	TGLPixelShader *frag_shader, const void *frag_data)
+{
+	unsigned clip_planes;
+	if (itgl_reject_triangle(tgl, verts, cull_face, &clip_planes))
+		return;
+
+#ifndef TERMGL_MINIMAL
+	/* Texture, sampled at the same mip level by all pieces of the triangle remaining after
+	 * clipping */
+	if (tgl->texture && !tgl->prim_shader) {
+		frag_shader = &itgl_pixel_shader_texture_level;
+		frag_data = itgl_texture_level(tgl, tgl->texture, verts, uv);
+	}
+#endif
+
+	/* Primitive shader, whose output is shared by all pieces of the triangle remaining after
+	 * clipping */
+	FlatShade flat;
+	if (tgl->prim_shader) {
+		tgl->prim_shader(obj, &flat.color, &flat.c, tgl->prim_data);
+		frag_shader = &itgl_pixel_shader_flat;
+		frag_data = &flat;
+	}
+
+	/* Trivial acceptance if no clipping is needed */
+	if (!clip_planes)
+		itgl_draw_triangle(tgl, verts, uv, fill, frag_shader, frag_data);
+	else
+		itgl_clip_triangle(tgl, verts, uv, clip_planes, fill, frag_shader, frag_data);
+}
+
+/* Clips a triangle against the planes in clip_planes and draws the result */
+void itgl_clip_triangle(TGL *const tgl, const TGLVec4 verts[3], const uint8_t (*const uv)[2],
+	const unsigned clip_planes, const bool fill, TGLPixelShader *const frag_shader,
+	const void *const frag_data)
+{
+	TGLUVTriangle trig_buffer
+		[127]; /* the size of this buffer assumes a pathological case which is probably impossible */
+	memcpy(&(trig_buffer[0].verts), verts, sizeof(TGLVec4[3]));
+	memcpy(&(trig_buffer[0].uv), uv, sizeof(uint8_t[3][2]));
+	unsigned buffer_offset = 0;
+	unsigned n_cur_stage = 1;
+	unsigned i, p;
+	for (p = 0; p < 6; p++) {
+		if (!(clip_planes & (1U << p)))
+			continue;
+		unsigned n_next_stage = 0;
+		for (i = 0; i < n_cur_stage; i++) {
+			n_next_stage += itgl_clip_triangle_plane(p, &trig_buffer[i + buffer_offset],
+				&trig_buffer[buffer_offset + n_cur_stage + n_next_stage]);
+		}
+		buffer_offset += n_cur_stage;
+		n_cur_stage = n_next_stage;
+	}
+
+	for (i = 0; i < n_cur_stage; i++)
+		itgl_draw_triangle(tgl, (const TGLVec4 *)trig_buffer[i + buffer_offset].verts,
+			(const uint8_t(*)[2])trig_buffer[i + buffer_offset].uv, fill, frag_shader,
+			frag_data);
+}
+
+/* Projects a triangle within the guard band onto the screen and rasterizes it */
+void itgl_draw_triangle(TGL *const tgl, const TGLVec4 verts[3], const uint8_t (*const uv)[2],
+	const bool fill, TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	const float half_width = tgl->width * .5f;
+	const float half_height = tgl->height * .5f;
+	float x[3], y[3], z[3];
+	unsigned i;
+	for (i = 0; i < 3; i++) {
+		const float inv_w = 1.f / verts[i][3];
+		x[i] = MAP_COORD(half_width, verts[i][0] * inv_w);
+		y[i] = MAP_COORD(half_height, verts[i][1] * inv_w);
+		z[i] = verts[i][2] * inv_w;
+	}
+
+	TGLVert v[3];
+	for (i = 0; i < 3; i++) {
+		/* floorf, as vertices in the guard band may have negative screen coordinates */
+		v[i] = (TGLVert){
+			.x = (int)floorf(x[i]),
+			.y = (int)floorf(y[i]),
+			.z = z[i],
+			.u = uv[i][0],
+			.v = uv[i][1],
+		};
+	}
+
+	if (fill)
+		tgl_triangle_fill(tgl, v[0], v[1], v[2], frag_shader, frag_data);
+	else
+		tgl_triangle(tgl, v[0], v[1], v[2], frag_shader, frag_data);
+}
+
+/* Culls, clips, and draws a triangle in clip space whose vertices have varyings */
+void itgl_triangle_varyings(TGL *const tgl, const TGLVec4 verts[3], const float *const varyings[3],
+	const unsigned n_varyings, const bool cull_face, TGLPixelShaderVaryings *const frag_shader,
+	const void *const frag_data)
+{
+	unsigned clip_planes;
+	if (itgl_reject_triangle(tgl, verts, cull_face, &clip_planes))
+		return;
+
+	VaryingVert poly[2][CLIP_POLYGON_SIZE];
+	unsigned i;
+	for (i = 0; i < 3; i++) {
+		memcpy(poly[0][i], verts[i], sizeof(TGLVec4));
+		memcpy(&poly[0][i][4], varyings[i], sizeof(float) * n_varyings);
+	}
+
+	/* Sutherland-Hodgman clipping, so that the varyings of the resulting polygon are only
+	 * interpolated once */
+	unsigned n = 3, cur = 0;
+	unsigned p;
+	for (p = 0; p < 6; p++) {
+		if (!(clip_planes & (1U << p)))
+			continue;
+		n = itgl_clip_polygon_plane(
+			p, (const VaryingVert *)poly[cur], n, n_varyings, poly[!cur]);
+		cur = !cur;
+		if (n < 3)
+			return;
+	}
+
+	for (i = 1; i + 1 < n; i++) {
+		const float *const trig[3] = { poly[cur][0], poly[cur][i], poly[cur][i + 1] };
+		itgl_raster_varyings(tgl, trig, n_varyings, frag_shader, frag_data);
+	}
+}
+
+/* Clips a convex polygon in clip space whose vertices have varyings against a plane */
+unsigned itgl_clip_polygon_plane(const enum ClipPlane plane, const VaryingVert *const in,
+	const unsigned n_in, const unsigned n_varyings, VaryingVert *const out)
+{
+	unsigned n_out = 0;
+	unsigned i, k;
+	for (i = 0; i < n_in; i++) {
+		const float *const a = in[i];
+		const float *const b = in[(i + 1) % n_in];
+		const float da = itgl_clip_plane_dot(a, plane);
+		const float db = itgl_clip_plane_dot(b, plane);
+		if (da >= 0.f)
+			memcpy(out[n_out++], a, sizeof(float) * (4 + n_varyings));
+		if ((da >= 0.f) != (db >= 0.f)) {
+			const float d = da / (da - db);
+			for (k = 0; k < 4 + n_varyings; k++)
+				out[n_out][k] = MIX(b[k], a[k], d);
+			n_out++;
+		}
+	}
+	return n_out;
+}
+
+/* Rasterizes a triangle within the guard band whose vertices have varyings, filling the same cells
+ * as triangles drawn by itgl_draw_triangle. Depth, 1 / w, and the varyings divided by w are linear
+ * in screen space, so they are stepped incrementally along each span, and divided by the
+ * interpolated 1 / w at each pixel
+ **/
+void itgl_raster_varyings(TGL *const tgl, const float *const verts[3], const unsigned n_varyings,
+	TGLPixelShaderVaryings *const frag_shader, const void *const frag_data)
+{
+	const float half_width = tgl->width * .5f;
+	const float half_height = tgl->height * .5f;
+	const unsigned n_attrs = 2 + n_varyings;
+	float x[3], y[3];
+	float attrs[3][2 + TGL_MAX_VARYINGS]; /* depth, 1 / w, and varyings divided by w */
+	unsigned i, k;
+	for (i = 0; i < 3; i++) {
+		const float inv_w = 1.f / verts[i][3];
+		x[i] = MAP_COORD(half_width, verts[i][0] * inv_w);
+		y[i] = MAP_COORD(half_height, verts[i][1] * inv_w);
+		attrs[i][0] = verts[i][2] * inv_w;
+		attrs[i][1] = inv_w;
+		for (k = 0; k < n_varyings; k++)
+			attrs[i][2 + k] = verts[i][4 + k] * inv_w;
+	}
+
+	const float dx1 = x[1] - x[0], dy1 = y[1] - y[0];
+	const float dx2 = x[2] - x[0], dy2 = y[2] - y[0];
+	const float area = dx1 * dy2 - dx2 * dy1;
+	if (area == 0.f)
+		return;
+
+	/* Screen space gradients of the attributes */
+	float ddx[2 + TGL_MAX_VARYINGS], ddy[2 + TGL_MAX_VARYINGS];
+	const float inv_area = 1.f / area;
+	for (k = 0; k < n_attrs; k++) {
+		const float d1 = attrs[1][k] - attrs[0][k];
+		const float d2 = attrs[2][k] - attrs[0][k];
+		ddx[k] = (d1 * dy2 - d2 * dy1) * inv_area;
+		ddy[k] = (d2 * dx1 - d1 * dx2) * inv_area;
+	}
+
+	const VaryingsRaster raster = {
+		.x0 = x[0],
+		.y0 = y[0],
+		.attrs = attrs[0],
+		.ddx = ddx,
+		.ddy = ddy,
+		.inv_w_min = MIN(MIN(attrs[0][1], attrs[1][1]), attrs[2][1]),
+		.inv_w_max = MAX(MAX(attrs[0][1], attrs[1][1]), attrs[2][1]),
+		.n_varyings = n_varyings,
+		.frag_shader = frag_shader,
+		.frag_data = frag_data,
+	};
+
+	/* Cells are covered by the same rule as itgl_draw_triangle, so that the pipelines match */
+	TGLVert v[3];
+	for (i = 0; i < 3; i++) {
+		v[i] = (TGLVert){
+			.x = (int)floorf(x[i]),
+			.y = (int)floorf(y[i]),
+			.z = attrs[i][0],
+		};
+	}
+	tgl_triangle_fill(tgl, v[0], v[1], v[2], &itgl_pixel_shader_varyings, &raster);
+}
+
+/* Marks the spans of itgl_raster_varyings for horiz_line, which passes them to itgl_span_varyings
+ * instead of calling it */
+void itgl_pixel_shader_varyings(const uint8_t u, const uint8_t v, TGLPixFmt *const color,
+	char *const c, const void *const data)
+{
+	(void)u;
+	(void)v;
+	(void)color;
+	(void)c;
+	(void)data;
+}
+
+void itgl_span_varyings(
+	TGL *const tgl, const int x0, const int x1, const int y, const VaryingsRaster *const raster)
+{
+	const unsigned n_attrs = 2 + raster->n_varyings;
+	float attr[2 + TGL_MAX_VARYINGS];
+	float varyings[TGL_MAX_VARYINGS];
+	unsigned k;
+	for (k = 0; k < n_attrs; k++)
+		attr[k] = raster->attrs[k] + raster->ddx[k] * (x0 + .5f - raster->x0)
+			+ raster->ddy[k] * (y + .5f - raster->y0);
+	int x;
+	for (x = x0; x <= x1; x++) {
+		if (!tgl->z_buffer_enabled
+			|| attr[0] >= tgl->z_buffer[y * tgl->width + x]) {
+			/* The centers of cells on the edges may lie outside the triangle, where
+			 * 1 / w is extrapolated */
+			const float inv_w = MAX(MIN(attr[1], raster->inv_w_max), raster->inv_w_min);
+			const float w = 1.f / inv_w;
+			for (k = 0; k < raster->n_varyings; k++)
+				varyings[k] = attr[2 + k] * w;
+			char c;
+			TGLPixFmt color;
+			raster->frag_shader(varyings, &color, &c, raster->frag_data);
+			set_pixel_raw(tgl, x, y, c, color);
+			if (tgl->z_buffer_enabled) {
+				tgl->z_buffer[y * tgl->width + x] = attr[0];
+				if (tgl->hiz_buffer)
+					tgl->hiz_dirty[(y >> HIZ_SHIFT_Y) * tgl->hiz_width
+						+ (x >> HIZ_SHIFT_X)] = true;
+			}
+		}
+		for (k = 0; k < n_attrs; k++)
+			attr[k] += raster->ddx[k];
+	}
+}
+
+void itgl_pixel_shader_flat(const uint8_t u, const uint8_t v, TGLPixFmt *const color, char *const c,
+	const void *const data)
+{
+	const FlatShade *const flat = data;
+	*color = flat->color;
+	*c = flat->c;
+	(void)u;
+	(void)v;
+}
+
+void tgl_primitive_shader(TGL *const tgl, TGLPrimitiveShader *const shader, const void *const data)
+{
+	tgl->prim_shader = shader;
+	tgl->prim_data = data;
+}
+
+void tgl_cull_face(TGL *const tgl, const uint8_t settings)
+{
+	tgl->settings = (tgl->settings & ~TGL_CULL_BIT)
+		| (XOR(settings & TGL_CULL_FACE_BIT, settings & TGL_WINDING_BIT) ? TGL_CULL_BIT :
+										   0);
+}
+
+#endif /* TERMGL3D */
+
+#ifdef TERMGLUTIL
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#ifdef TERMGL3D
+/* Read-only view of an entire file */
+typedef struct FileView {
+	const unsigned char *data; /* NULL if the file is empty */
+	size_t size;
+} FileView;
+
+/* Mesh returned by a loader, with its arrays following it or lying in view */
+typedef struct LoadedMesh {
+	TGLMesh mesh;
+	FileView view;
+} LoadedMesh;
+
+#ifndef TERMGL_MINIMAL
+/* Levels of detail lying in view, followed by the array of levels */
+typedef struct LoadedMeshLOD {
+	TGLMeshLOD lod;
+	FileView view;
+} LoadedMeshLOD;
+#endif /* ~TERMGL_MINIMAL */
+
+typedef struct WeldSlot {
+	uint32_t key[3];
+	uint32_t idx; /* UINT32_MAX if the slot is empty */
+} WeldSlot;
+
+/* Hash map assigning consecutive indices to distinct keys, used to merge vertices */
+typedef struct WeldMap {
+	WeldSlot *slots;
+	uint32_t mask; /* number of slots - 1 */
+	uint32_t count;
+} WeldMap;
+
+#define STL_HEADER_SIZE 84
+#define STL_TRIANGLE_SIZE 50 /* normal, 3 vertices, and attribute byte count */
+
+#define OBJ_NONE UINT32_MAX /* index of an absent texture coordinate or normal */
+
+/* Binary mesh file, holding the levels of a mesh in the layout of the machine which wrote it.
+ * Arrays start at multiples of MESH_FILE_ALIGN bytes, so they can be used in place once mapped */
+#define MESH_FILE_MAGIC "TGLM"
+#define MESH_FILE_VERSION 1
+#define MESH_FILE_BYTE_ORDER 0x01020304U
+#define MESH_FILE_ALIGN 16
+
+typedef struct MeshFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order; /* MESH_FILE_BYTE_ORDER in the byte order of the writing machine */
+	uint32_t index_size; /* sizeof(unsigned) */
+	uint32_t n_levels;
+	uint32_t reserved[3];
+} MeshFileHeader;
+
+/* Follows the header once per level, from finest to coarsest */
+typedef struct MeshFileLevel {
+	uint64_t verts; /* offsets of arrays from the start of the file, 0 for absent arrays */
+	uint64_t uvs;
+	uint64_t indices;
+	uint64_t normals;
+	uint64_t vert_normals;
+	uint32_t n_verts;
+	uint32_t n_triangles;
+	uint32_t res; /* grid resolution of the level of detail, UINT32_MAX for the original mesh */
+	float aabb[2][3];
+	uint32_t reserved;
+} MeshFileLevel;
+
+typedef struct ObjVert {
+	uint32_t key[3]; /* position, texture coordinate, and normal */
+	uint32_t next; /* previously created vertex with the same position, or OBJ_NONE */
+} ObjVert;
+
+static int itgl_file_map(const char *path, FileView *view);
+static void itgl_file_unmap(const FileView *view);
+static void itgl_stl_key(const unsigned char *vert, uint32_t key[3]);
+static uint32_t itgl_weld_hash(const uint32_t key[3]);
+static int itgl_weld_init(WeldMap *map, uint32_t capacity);
+static int itgl_weld_grow(WeldMap *map);
+static uint32_t itgl_weld_index(WeldMap *map, const uint32_t key[3]);
+static inline const char *itgl_obj_space(const char *p, const char *end);
+static inline bool itgl_obj_line_end(const char *p, const char *end);
+static bool itgl_obj_float(const char **p, const char *end, float *out);
+static bool itgl_obj_index(const char **p, const char *end, unsigned count, uint32_t *out);
+static inline uint8_t itgl_obj_uv(float f);
+static void itgl_mesh_file_arrays(const TGLMesh *mesh, const void *arrays[5], size_t sizes[5]);
+static int itgl_mesh_file_write(const char *path, const TGLMesh *const *meshes,
+	const unsigned *res, unsigned n_levels);
+static int itgl_mesh_file_map(const char *path, FileView *view, uint32_t *n_levels);
+static int itgl_mesh_file_array(
+	const FileView *view, uint64_t offset, uint64_t size, bool required, const void **out);
+static int itgl_mesh_file_level(const FileView *view, uint32_t idx, TGLMesh *mesh, unsigned *res);
+#endif /* TERMGL3D */
+
+#ifdef __unix__
+static inline uint8_t itgl_xterm_button_conv(uint8_t button);
+
+uint8_t itgl_xterm_button_conv(const uint8_t button)
+{
+	const uint8_t mod = (button & 0x40) ? TGL_MOUSE_WHEEL_OR_MOVEMENT : 0x00;
+	switch ((button - 32) & 0x03) {
+	case 0x00:
+		return TGL_MOUSE_1 | mod;
+	case 0x01:
+		return TGL_MOUSE_3 | mod;
+	case 0x02:
+		return TGL_MOUSE_2 | mod;
+	case 0x03:
+		return TGL_MOUSE_RELEASE | mod;
+	}
+	TGL_UNREACHABLE();
+	return 0;
+}
+#endif /* __unix__ */
+
+#ifdef TGL_OS_WINDOWS
+static inline uint8_t itgl_windows_mouse_event_record_conv(
+	MOUSE_EVENT_RECORD record, uint8_t *state);
+
+uint8_t itgl_windows_mouse_event_record_conv(const MOUSE_EVENT_RECORD record, uint8_t *const state)
+{
+	if (record.dwEventFlags & (MOUSE_WHEELED | 0x0008 | MOUSE_MOVED))
+		return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
+	const uint8_t changed = *state ^ record.dwButtonState;
+	if (changed & *state) {
+		*state = record.dwButtonState;
+		return TGL_MOUSE_RELEASE;
+	}
+	*state = record.dwButtonState;
+	if (changed & 0x01)
+		return TGL_MOUSE_1;
+	if (changed & 0x02)
+		return TGL_MOUSE_2;
+	if (changed & 0x04)
+		return TGL_MOUSE_3;
+	return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
+}
+#endif /* TGL_OS_WINDOWS */
+
+TGL_SSIZE_T tglutil_read(char *const buf, const size_t count, TGLMouseEvent *const event_buf,
+	const size_t count_events, size_t *const count_read_events)
+{
+#ifdef __unix__
+	struct termios oldt, newt;
+
+	/* Disable canonical mode */
+	CALL(tcgetattr(STDIN_FILENO, &oldt), -2);
+	newt = oldt;
+	newt.c_lflag &= ~(ICANON);
+	newt.c_cc[VMIN] = 0;
+	newt.c_cc[VTIME] = 0;
+	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &newt), -3);
+
+	const TGL_SSIZE_T retval = read(2, buf, count);
+
+	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &oldt), -3);
+
+	/* Flush input buffer to prevent read of previous unread input */
+	CALL(tcflush(STDIN_FILENO, TCIFLUSH), -4);
+
+	if (!event_buf || retval <= 0)
+		return retval;
+
+	/* Parse mouse events */
+	*count_read_events = 0;
+	size_t rd, wr = 0;
+	for (rd = 0; rd < (size_t)retval; rd++) {
+		if (buf[rd] == '\033' && buf[rd + 1] == '[' && buf[rd + 2] == 'M') {
+			if (*count_read_events < count_events
+				&& ((buf[rd + 3] & 0x7f) == buf[rd + 3]))
+				event_buf[(*count_read_events)++] = (TGLMouseEvent){
+					.button = itgl_xterm_button_conv(buf[rd + 3]),
+					.x = buf[rd + 4] - 32,
+					.y = buf[rd + 5] - 32,
+				};
+			rd += 5;
+			continue;
 		}
 		buf[wr++] = buf[rd];
 	}
@@ -1453,4 +4168,829 @@ int tglutil_set_mouse_tracking_enabled(const bool enabled)
 	return 0;
 }
 
+#ifdef TERMGL3D
+/* Maps a file into memory, returning 0 on success and -1 on failure */
+int itgl_file_map(const char *const path, FileView *const view)
+{
+	view->data = NULL;
+#ifdef __unix__
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st))
+		goto LBL_ERR;
+	view->size = st.st_size;
+	if (view->size) {
+		void *const data = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			goto LBL_ERR;
+		view->data = data;
+	}
+	close(fd);
+	return 0;
+
+LBL_ERR:;
+	const int err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+#else /* defined(TGL_OS_WINDOWS) */
+	const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	WINDOWS_CALL(file == INVALID_HANDLE_VALUE, -1);
+	HANDLE mapping = NULL;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+		goto LBL_ERR;
+	view->size = size.QuadPart;
+	if (view->size) {
+		/* The view remains valid after its mapping and file handles are closed */
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			goto LBL_ERR;
+		view->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!view->data)
+			goto LBL_ERR;
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	return 0;
+
+LBL_ERR:
+	errno = GetLastError();
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return -1;
+#endif
+}
+
+void itgl_file_unmap(const FileView *const view)
+{
+	if (!view->data)
+		return;
+#ifdef __unix__
+	munmap((void *)view->data, view->size);
+#else /* defined(TGL_OS_WINDOWS) */
+	UnmapViewOfFile(view->data);
+#endif
+}
+
+/* Gets the bits of a vertex's coordinates, with -0 replaced by 0 */
+void itgl_stl_key(const unsigned char *const vert, uint32_t key[3])
+{
+	float coords[3];
+	memcpy(coords, vert, sizeof(coords));
+	unsigned i;
+	for (i = 0; i < 3; i++) {
+		coords[i] += 0.F;
+		memcpy(&key[i], &coords[i], sizeof(uint32_t));
+	}
+}
+
+uint32_t itgl_weld_hash(const uint32_t key[3])
+{
+	uint32_t hash = 0;
+	unsigned i;
+	for (i = 0; i < 3; i++) {
+		hash = (hash ^ key[i]) * 0x9E3779B1U;
+		hash ^= hash >> 16;
+	}
+	/* Finalizer of MurmurHash3, as keys often differ only in a few bits */
+	hash *= 0x85EBCA6BU;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35U;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/* Creates an empty map which holds capacity keys before growing, returning 0 on success and -1 on
+ * failure */
+int itgl_weld_init(WeldMap *const map, const uint32_t capacity)
+{
+	/* The map is kept at most half full */
+	uint32_t n_slots = 16;
+	while (n_slots < capacity * 2)
+		n_slots <<= 1;
+	map->slots = TGL_MALLOC(sizeof(WeldSlot) * n_slots);
+	if (!map->slots)
+		return -1;
+	memset(map->slots, 0xFF, sizeof(WeldSlot) * n_slots);
+	map->mask = n_slots - 1;
+	map->count = 0;
+	return 0;
+}
+
+int itgl_weld_grow(WeldMap *const map)
+{
+	const WeldMap old = *map;
+	if (itgl_weld_init(map, old.mask + 1))
+		return -1;
+	uint32_t i;
+	for (i = 0; i <= old.mask; i++) {
+		if (old.slots[i].idx == UINT32_MAX)
+			continue;
+		uint32_t slot = itgl_weld_hash(old.slots[i].key) & map->mask;
+		while (map->slots[slot].idx != UINT32_MAX)
+			slot = (slot + 1) & map->mask;
+		map->slots[slot] = old.slots[i];
+	}
+	map->count = old.count;
+	TGL_FREE(old.slots);
+	return 0;
+}
+
+/* Gets the index of a key, inserting it with the next index if it is absent. Returns UINT32_MAX on
+ * failure */
+uint32_t itgl_weld_index(WeldMap *const map, const uint32_t key[3])
+{
+	if ((map->count + 1) * 2 > map->mask + 1 && itgl_weld_grow(map))
+		return UINT32_MAX;
+	uint32_t slot;
+	for (slot = itgl_weld_hash(key) & map->mask;; slot = (slot + 1) & map->mask) {
+		WeldSlot *const cur = &map->slots[slot];
+		if (cur->idx == UINT32_MAX) {
+			memcpy(cur->key, key, sizeof(cur->key));
+			cur->idx = map->count++;
+			return cur->idx;
+		}
+		if (!memcmp(cur->key, key, sizeof(cur->key)))
+			return cur->idx;
+	}
+}
+
+TGLMesh *tglutil_mesh_load_stl(const char *const path)
+{
+	FileView view;
+	if (itgl_file_map(path, &view))
+		return NULL;
+
+	TGLMesh *mesh = NULL;
+	WeldMap map = { 0 };
+	unsigned *remap = NULL;
+	uint32_t n_triangles;
+	if (view.size < STL_HEADER_SIZE)
+		goto LBL_EINVAL;
+	memcpy(&n_triangles, view.data + STL_HEADER_SIZE - sizeof(uint32_t), sizeof(uint32_t));
+	if (n_triangles > (view.size - STL_HEADER_SIZE) / STL_TRIANGLE_SIZE)
+		goto LBL_EINVAL;
+	if (n_triangles > UINT32_MAX / 16) {
+		errno = ENOMEM;
+		goto LBL_END;
+	}
+
+	/* Assign indices to vertices in order of their first appearance. Closed meshes have about
+	 * half as many vertices as triangles */
+	const unsigned char *const tris = view.data + STL_HEADER_SIZE;
+	const unsigned n_corners = n_triangles * 3;
+	remap = TGL_MALLOC(sizeof(unsigned) * n_corners);
+	if (!remap || itgl_weld_init(&map, n_triangles))
+		goto LBL_END;
+	unsigned i;
+	for (i = 0; i < n_corners; i++) {
+		uint32_t key[3];
+		itgl_stl_key(tris + i / 3 * STL_TRIANGLE_SIZE + (i % 3 + 1) * sizeof(TGLVec3), key);
+		remap[i] = itgl_weld_index(&map, key);
+		if (remap[i] == UINT32_MAX)
+			goto LBL_END;
+	}
+
+	const unsigned n_verts = map.count;
+	LoadedMesh *const loaded = TGL_MALLOC(sizeof(LoadedMesh)
+		+ sizeof(TGLVec3) * (n_verts + n_triangles) + sizeof(unsigned) * n_corners);
+	if (!loaded)
+		goto LBL_END;
+	loaded->view.data = NULL;
+	mesh = &loaded->mesh;
+	TGLVec3 *const verts = (TGLVec3 *)(loaded + 1);
+	TGLVec3 *const normals = verts + n_verts;
+	unsigned *const indices = (unsigned *)(normals + n_triangles);
+	memcpy(indices, remap, sizeof(unsigned) * n_corners);
+	unsigned n_copied = 0;
+	for (i = 0; i < n_corners && n_copied < n_verts; i++) {
+		if (remap[i] == n_copied) {
+			memcpy(verts[n_copied++],
+				tris + i / 3 * STL_TRIANGLE_SIZE + (i % 3 + 1) * sizeof(TGLVec3),
+				sizeof(TGLVec3));
+		}
+	}
+
+	/* Normals stored in STL files are often zero or disagree with the winding, so they are
+	 * computed from the vertices instead, as required by tgl_cull_matrix */
+	for (i = 0; i < n_triangles; i++) {
+		const float *const v0 = verts[indices[3 * i]];
+		const float *const v1 = verts[indices[3 * i + 1]];
+		const float *const v2 = verts[indices[3 * i + 2]];
+		const TGLVec3 e1 = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+		const TGLVec3 e2 = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+		float *const normal = normals[i];
+		normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		const float mag = sqrtf(normal[0] * normal[0] + normal[1] * normal[1]
+			+ normal[2] * normal[2]);
+		if (mag > 0.f) {
+			normal[0] /= mag;
+			normal[1] /= mag;
+			normal[2] /= mag;
+		}
+	}
+	*mesh = (TGLMesh){
+		.verts = (const TGLVec3 *)verts,
+		.indices = indices,
+		.normals = (const TGLVec3 *)normals,
+		.n_verts = n_verts,
+		.n_triangles = n_triangles,
+	};
+	tgl_mesh_bounds(mesh);
+	goto LBL_END;
+
+LBL_EINVAL:
+	errno = EINVAL;
+LBL_END:
+	TGL_FREE(remap);
+	TGL_FREE(map.slots);
+	itgl_file_unmap(&view);
+	return mesh;
+}
+
+/* Skips spaces and tabs */
+const char *itgl_obj_space(const char *p, const char *const end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+bool itgl_obj_line_end(const char *const p, const char *const end)
+{
+	return p == end || *p == '\n' || *p == '\r' || *p == '#';
+}
+
+/* Parses a decimal floating point number, without the precision of strtod but many times faster */
+bool itgl_obj_float(const char **const p_, const char *const end, float *const out)
+{
+	static const double pow10[] = {
+		1e0,
+		1e1,
+		1e2,
+		1e3,
+		1e4,
+		1e5,
+		1e6,
+		1e7,
+		1e8,
+		1e9,
+		1e10,
+		1e11,
+		1e12,
+		1e13,
+		1e14,
+		1e15,
+		1e16,
+		1e17,
+		1e18,
+		1e19,
+		1e20,
+		1e21,
+		1e22,
+	};
+	const char *p = itgl_obj_space(*p_, end);
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	/* Digits past the 19th do not fit into the mantissa, and only affect the exponent */
+	uint64_t mantissa = 0;
+	int exp = 0;
+	unsigned n_digits = 0;
+	for (; p < end && (unsigned)(*p - '0') < 10; p++, n_digits++) {
+		if (mantissa < UINT64_C(1000000000000000000))
+			mantissa = mantissa * 10 + (unsigned)(*p - '0');
+		else
+			exp++;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && (unsigned)(*p - '0') < 10; p++, n_digits++) {
+			if (mantissa < UINT64_C(1000000000000000000)) {
+				mantissa = mantissa * 10 + (unsigned)(*p - '0');
+				exp--;
+			}
+		}
+	}
+	if (!n_digits)
+		return false;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool exp_neg = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			exp_neg = *p++ == '-';
+		if (p == end || (unsigned)(*p - '0') >= 10)
+			return false;
+		int e = 0;
+		for (; p < end && (unsigned)(*p - '0') < 10; p++)
+			if (e < 1000)
+				e = e * 10 + (*p - '0');
+		exp += exp_neg ? -e : e;
+	}
+
+	double val = (double)mantissa;
+	for (; exp > 22; exp -= 22)
+		val *= 1e22;
+	for (; exp < -22; exp += 22)
+		val /= 1e22;
+	val = (exp < 0) ? val / pow10[-exp] : val * pow10[exp];
+	*out = (float)(neg ? -val : val);
+	*p_ = p;
+	return true;
+}
+
+/* Parses a 1-based or negative relative index into an array of count elements, converting it to
+ * 0-based */
+bool itgl_obj_index(const char **const p_, const char *const end, const unsigned count,
+	uint32_t *const out)
+{
+	const char *p = *p_;
+	const bool relative = p < end && *p == '-';
+	if (relative)
+		p++;
+	if (p == end || (unsigned)(*p - '0') >= 10)
+		return false;
+	uint32_t idx = 0;
+	for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+		if (idx > count)
+			return false;
+		idx = idx * 10 + (unsigned)(*p - '0');
+	}
+	if (!idx || idx > count)
+		return false;
+	*out = relative ? count - idx : idx - 1;
+	*p_ = p;
+	return true;
+}
+
+uint8_t itgl_obj_uv(const float f)
+{
+	return (uint8_t)(MAX(0.F, MIN(1.F, f)) * 255.F + .5F);
+}
+
+TGLMesh *tglutil_mesh_load_obj(const char *const path)
+{
+	FileView view;
+	if (itgl_file_map(path, &view))
+		return NULL;
+
+	TGLMesh *mesh = NULL;
+	TGLVec3 *positions = NULL;
+	uint32_t *position_verts = NULL; /* last vertex created with each position, or OBJ_NONE */
+	float(*tex_coords)[2] = NULL;
+	TGLVec3 *normals = NULL;
+	ObjVert *obj_verts = NULL;
+	unsigned *indices = NULL;
+	unsigned n_positions = 0, positions_capacity = 0, position_verts_capacity = 0;
+	unsigned n_tex_coords = 0, tex_coords_capacity = 0;
+	unsigned n_normals = 0, normals_capacity = 0;
+	unsigned n_verts = 0, obj_verts_capacity = 0;
+	unsigned n_indices = 0, indices_capacity = 0;
+
+	const char *p = (const char *)view.data;
+	const char *const end = p + view.size;
+	while (p < end) {
+		p = itgl_obj_space(p, end);
+		const bool vert = end - p >= 2 && p[0] == 'v';
+		if (vert && (p[1] == ' ' || p[1] == '\t')) {
+			void *const buf = reserve(
+				positions, &positions_capacity, sizeof(TGLVec3), n_positions + 1);
+			if (!buf)
+				goto LBL_END;
+			positions = buf;
+			void *const verts_buf = reserve(position_verts, &position_verts_capacity,
+				sizeof(uint32_t), n_positions + 1);
+			if (!verts_buf)
+				goto LBL_END;
+			position_verts = verts_buf;
+			position_verts[n_positions] = OBJ_NONE;
+			p++;
+			unsigned i;
+			for (i = 0; i < 3; i++)
+				if (!itgl_obj_float(&p, end, &positions[n_positions][i]))
+					goto LBL_EINVAL;
+			n_positions++;
+		} else if (vert && p[1] == 't') {
+			void *const buf = reserve(tex_coords, &tex_coords_capacity,
+				sizeof(float[2]), n_tex_coords + 1);
+			if (!buf)
+				goto LBL_END;
+			tex_coords = buf;
+			p += 2;
+			if (!itgl_obj_float(&p, end, &tex_coords[n_tex_coords][0]))
+				goto LBL_EINVAL;
+			p = itgl_obj_space(p, end);
+			tex_coords[n_tex_coords][1] = 0.F;
+			if (!itgl_obj_line_end(p, end)
+				&& !itgl_obj_float(&p, end, &tex_coords[n_tex_coords][1]))
+				goto LBL_EINVAL;
+			n_tex_coords++;
+		} else if (vert && p[1] == 'n') {
+			void *const buf =
+				reserve(normals, &normals_capacity, sizeof(TGLVec3), n_normals + 1);
+			if (!buf)
+				goto LBL_END;
+			normals = buf;
+			p += 2;
+			unsigned i;
+			for (i = 0; i < 3; i++)
+				if (!itgl_obj_float(&p, end, &normals[n_normals][i]))
+					goto LBL_EINVAL;
+			n_normals++;
+		} else if (end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			/* Triangulate the polygon as a fan around its first corner */
+			uint32_t first = 0, prev = 0;
+			unsigned n = 0;
+			for (p++;; n++) {
+				p = itgl_obj_space(p, end);
+				if (itgl_obj_line_end(p, end))
+					break;
+				uint32_t key[3] = { 0, OBJ_NONE, OBJ_NONE };
+				if (!itgl_obj_index(&p, end, n_positions, &key[0]))
+					goto LBL_EINVAL;
+				if (p < end && *p == '/') {
+					p++;
+					if (p < end && *p != '/'
+						&& !itgl_obj_index(&p, end, n_tex_coords, &key[1]))
+						goto LBL_EINVAL;
+					if (p < end && *p == '/') {
+						p++;
+						if (!itgl_obj_index(&p, end, n_normals, &key[2]))
+							goto LBL_EINVAL;
+					}
+				}
+				if (!itgl_obj_line_end(p, end) && *p != ' ' && *p != '\t')
+					goto LBL_EINVAL;
+
+				/* Search the vertices with the same position, of which there are
+				 * usually few */
+				uint32_t idx = position_verts[key[0]];
+				while (idx != OBJ_NONE
+					&& memcmp(obj_verts[idx].key, key, sizeof(key)))
+					idx = obj_verts[idx].next;
+				if (idx == OBJ_NONE) {
+					void *const buf = reserve(obj_verts, &obj_verts_capacity,
+						sizeof(ObjVert), n_verts + 1);
+					if (!buf)
+						goto LBL_END;
+					obj_verts = buf;
+					idx = n_verts++;
+					memcpy(obj_verts[idx].key, key, sizeof(key));
+					obj_verts[idx].next = position_verts[key[0]];
+					position_verts[key[0]] = idx;
+				}
+				if (n >= 2) {
+					void *const buf = reserve(indices, &indices_capacity,
+						sizeof(unsigned), n_indices + 3);
+					if (!buf)
+						goto LBL_END;
+					indices = buf;
+					indices[n_indices++] = first;
+					indices[n_indices++] = prev;
+					indices[n_indices++] = idx;
+				} else if (!n) {
+					first = idx;
+				}
+				prev = idx;
+			}
+			if (n < 3)
+				goto LBL_EINVAL;
+		}
+
+		const char *const line_end = memchr(p, '\n', end - p);
+		p = line_end ? line_end + 1 : end;
+	}
+
+	/* Gather the attributes of each vertex */
+	const bool has_uvs = n_tex_coords > 0;
+	const bool has_normals = n_normals > 0;
+	LoadedMesh *const loaded = TGL_MALLOC(sizeof(LoadedMesh)
+		+ sizeof(TGLVec3) * n_verts * (1 + has_normals) + sizeof(unsigned) * n_indices
+		+ sizeof(uint8_t[2]) * n_verts * has_uvs);
+	if (!loaded)
+		goto LBL_END;
+	loaded->view.data = NULL;
+	mesh = &loaded->mesh;
+	TGLVec3 *const verts = (TGLVec3 *)(loaded + 1);
+	TGLVec3 *const vert_normals = verts + n_verts;
+	unsigned *const mesh_indices = (unsigned *)(vert_normals + n_verts * has_normals);
+	uint8_t(*const uvs)[2] = (uint8_t(*)[2])(mesh_indices + n_indices);
+	/* indices is NULL if the file has no faces */
+	if (n_indices)
+		memcpy(mesh_indices, indices, sizeof(unsigned) * n_indices);
+	unsigned i;
+	for (i = 0; i < n_verts; i++) {
+		const uint32_t *const key = obj_verts[i].key;
+		memcpy(verts[i], positions[key[0]], sizeof(TGLVec3));
+		if (has_uvs) {
+			const float *const uv = (key[1] == OBJ_NONE) ? NULL : tex_coords[key[1]];
+			uvs[i][0] = uv ? itgl_obj_uv(uv[0]) : 0;
+			uvs[i][1] = uv ? itgl_obj_uv(1.F - uv[1]) : 0;
+		}
+		if (has_normals) {
+			if (key[2] == OBJ_NONE) {
+				memset(vert_normals[i], 0, sizeof(TGLVec3));
+				continue;
+			}
+			/* tgl_norm3 is not available with TERMGL_MINIMAL */
+			const float *const normal = normals[key[2]];
+			const float mag = sqrtf(normal[0] * normal[0] + normal[1] * normal[1]
+				+ normal[2] * normal[2]);
+			if (mag > 0.f) {
+				vert_normals[i][0] = normal[0] / mag;
+				vert_normals[i][1] = normal[1] / mag;
+				vert_normals[i][2] = normal[2] / mag;
+			} else {
+				memset(vert_normals[i], 0, sizeof(TGLVec3));
+			}
+		}
+	}
+	*mesh = (TGLMesh){
+		.verts = (const TGLVec3 *)verts,
+		.uvs = has_uvs ? (const uint8_t(*)[2])uvs : NULL,
+		.indices = mesh_indices,
+		.vert_normals = has_normals ? (const TGLVec3 *)vert_normals : NULL,
+		.n_verts = n_verts,
+		.n_triangles = n_indices / 3,
+	};
+	tgl_mesh_bounds(mesh);
+	goto LBL_END;
+
+LBL_EINVAL:
+	errno = EINVAL;
+LBL_END:
+	TGL_FREE(indices);
+	TGL_FREE(obj_verts);
+	TGL_FREE(normals);
+	TGL_FREE(tex_coords);
+	TGL_FREE(position_verts);
+	TGL_FREE(positions);
+	itgl_file_unmap(&view);
+	return mesh;
+}
+
+/* Gets the arrays of a mesh in the order they are stored in a binary mesh file, and their sizes */
+void itgl_mesh_file_arrays(const TGLMesh *const mesh, const void *arrays[5], size_t sizes[5])
+{
+	arrays[0] = mesh->verts;
+	arrays[1] = mesh->uvs;
+	arrays[2] = mesh->indices;
+	arrays[3] = mesh->normals;
+	arrays[4] = mesh->vert_normals;
+	sizes[0] = sizeof(TGLVec3) * mesh->n_verts;
+	sizes[1] = sizeof(uint8_t[2]) * mesh->n_verts;
+	sizes[2] = sizeof(unsigned[3]) * mesh->n_triangles;
+	sizes[3] = sizeof(TGLVec3) * mesh->n_triangles;
+	sizes[4] = sizeof(TGLVec3) * mesh->n_verts;
+}
+
+/* Writes levels of a mesh to a binary mesh file, returning 0 on success and -1 on failure */
+int itgl_mesh_file_write(const char *const path, const TGLMesh *const *const meshes,
+	const unsigned *const res, const unsigned n_levels)
+{
+	static const unsigned char zeros[MESH_FILE_ALIGN] = { 0 };
+	FILE *const file = fopen(path, "wb");
+	if (!file)
+		return -1;
+
+	const MeshFileHeader header = {
+		.magic = MESH_FILE_MAGIC,
+		.version = MESH_FILE_VERSION,
+		.byte_order = MESH_FILE_BYTE_ORDER,
+		.index_size = sizeof(unsigned),
+		.n_levels = n_levels,
+	};
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		goto LBL_ERR;
+
+	/* Level table, followed by the arrays of each level in turn */
+	const void *arrays[5];
+	size_t sizes[5];
+	uint64_t offset = sizeof(MeshFileHeader) + sizeof(MeshFileLevel) * n_levels;
+	unsigned i, j;
+	for (i = 0; i < n_levels; i++) {
+		TGLMesh mesh = *meshes[i];
+		tgl_mesh_bounds(&mesh);
+		MeshFileLevel level = {
+			.n_verts = mesh.n_verts,
+			.n_triangles = mesh.n_triangles,
+			.res = (res[i] == UINT_MAX) ? UINT32_MAX : res[i],
+		};
+		memcpy(level.aabb, mesh.aabb, sizeof(level.aabb));
+		uint64_t *const offsets[5] = { &level.verts, &level.uvs, &level.indices,
+			&level.normals, &level.vert_normals };
+		itgl_mesh_file_arrays(&mesh, arrays, sizes);
+		for (j = 0; j < 5; j++) {
+			if (!arrays[j])
+				continue;
+			*offsets[j] = offset;
+			offset += (sizes[j] + MESH_FILE_ALIGN - 1)
+				& ~(uint64_t)(MESH_FILE_ALIGN - 1);
+		}
+		if (fwrite(&level, sizeof(level), 1, file) != 1)
+			goto LBL_ERR;
+	}
+
+	for (i = 0; i < n_levels; i++) {
+		itgl_mesh_file_arrays(meshes[i], arrays, sizes);
+		for (j = 0; j < 5; j++) {
+			if (!arrays[j])
+				continue;
+			const size_t padding =
+				(MESH_FILE_ALIGN - sizes[j] % MESH_FILE_ALIGN) % MESH_FILE_ALIGN;
+			if (fwrite(arrays[j], 1, sizes[j], file) != sizes[j]
+				|| fwrite(zeros, 1, padding, file) != padding)
+				goto LBL_ERR;
+		}
+	}
+
+	return fclose(file) ? -1 : 0;
+
+LBL_ERR:;
+	const int err = errno;
+	fclose(file);
+	errno = err;
+	return -1;
+}
+
+/* Maps a binary mesh file and checks its header, returning 0 on success and -1 on failure */
+int itgl_mesh_file_map(const char *const path, FileView *const view, uint32_t *const n_levels)
+{
+	if (itgl_file_map(path, view))
+		return -1;
+	MeshFileHeader header;
+	if (view->size < sizeof(header))
+		goto LBL_EINVAL;
+	memcpy(&header, view->data, sizeof(header));
+	if (memcmp(header.magic, MESH_FILE_MAGIC, sizeof(header.magic))
+		|| header.version != MESH_FILE_VERSION || header.byte_order != MESH_FILE_BYTE_ORDER
+		|| header.index_size != sizeof(unsigned) || !header.n_levels
+		|| header.n_levels > (view->size - sizeof(header)) / sizeof(MeshFileLevel))
+		goto LBL_EINVAL;
+	*n_levels = header.n_levels;
+	return 0;
+
+LBL_EINVAL:
+	itgl_file_unmap(view);
+	errno = EINVAL;
+	return -1;
+}
+
+/* Gets an array of size bytes in a mapped binary mesh file, returning 0 on success, -1 if
+ * invalid */
+int itgl_mesh_file_array(const FileView *const view, const uint64_t offset, const uint64_t size,
+	const bool required, const void **const out)
+{
+	if (!offset) {
+		*out = NULL;
+		return (required && size) ? -1 : 0;
+	}
+	if (offset % MESH_FILE_ALIGN || offset > view->size || size > view->size - offset)
+		return -1;
+	*out = view->data + offset;
+	return 0;
+}
+
+/* Points a mesh at a level of a mapped binary mesh file, returning 0 on success, -1 if invalid */
+int itgl_mesh_file_level(
+	const FileView *const view, const uint32_t idx, TGLMesh *const mesh, unsigned *const res)
+{
+	MeshFileLevel level;
+	memcpy(&level, view->data + sizeof(MeshFileHeader) + sizeof(MeshFileLevel) * idx,
+		sizeof(level));
+	/* Sizes are computed in 64 bits, as they could overflow a 32-bit size_t */
+	const uint64_t n_verts = level.n_verts;
+	const uint64_t n_triangles = level.n_triangles;
+	const void *arrays[5];
+	if (itgl_mesh_file_array(view, level.verts, sizeof(TGLVec3) * n_verts, true, &arrays[0])
+		|| itgl_mesh_file_array(
+			view, level.uvs, sizeof(uint8_t[2]) * n_verts, false, &arrays[1])
+		|| itgl_mesh_file_array(
+			view, level.indices, sizeof(unsigned[3]) * n_triangles, true, &arrays[2])
+		|| itgl_mesh_file_array(
+			view, level.normals, sizeof(TGLVec3) * n_triangles, false, &arrays[3])
+		|| itgl_mesh_file_array(
+			view, level.vert_normals, sizeof(TGLVec3) * n_verts, false, &arrays[4]))
+		return -1;
+
+	/* Indices are used without bounds checks when drawing */
+	const unsigned *const indices = arrays[2];
+	uint64_t i;
+	for (i = 0; i < 3 * n_triangles; i++)
+		if (indices[i] >= level.n_verts)
+			return -1;
+	*mesh = (TGLMesh){
+		.verts = (const TGLVec3 *)arrays[0],
+		.uvs = (const uint8_t(*)[2])arrays[1],
+		.indices = arrays[2],
+		.normals = (const TGLVec3 *)arrays[3],
+		.vert_normals = (const TGLVec3 *)arrays[4],
+		.n_verts = level.n_verts,
+		.n_triangles = level.n_triangles,
+	};
+	memcpy(mesh->aabb, level.aabb, sizeof(mesh->aabb));
+	*res = (level.res == UINT32_MAX) ? UINT_MAX : level.res;
+	return 0;
+}
+
+int tglutil_mesh_save(const char *const path, const TGLMesh *const mesh)
+{
+	const unsigned res = UINT_MAX;
+	return itgl_mesh_file_write(path, &mesh, &res, 1);
+}
+
+TGLMesh *tglutil_mesh_load(const char *const path)
+{
+	FileView view;
+	uint32_t n_levels;
+	if (itgl_mesh_file_map(path, &view, &n_levels))
+		return NULL;
+	LoadedMesh *const loaded = TGL_MALLOC(sizeof(LoadedMesh));
+	if (!loaded) {
+		itgl_file_unmap(&view);
+		return NULL;
+	}
+	unsigned res;
+	if (itgl_mesh_file_level(&view, 0, &loaded->mesh, &res)) {
+		TGL_FREE(loaded);
+		itgl_file_unmap(&view);
+		errno = EINVAL;
+		return NULL;
+	}
+	loaded->view = view;
+	return &loaded->mesh;
+}
+
+void tglutil_mesh_free(TGLMesh *const mesh)
+{
+	LoadedMesh *const loaded = (LoadedMesh *)mesh;
+	itgl_file_unmap(&loaded->view);
+	TGL_FREE(loaded);
+}
+
+#ifndef TERMGL_MINIMAL
+int tglutil_mesh_lod_save(const char *const path, const TGLMeshLOD *const lod)
+{
+	const TGLMesh **const meshes =
+		TGL_MALLOC((sizeof(TGLMesh *) + sizeof(unsigned)) * lod->n_levels);
+	if (!meshes)
+		return -1;
+	unsigned *const res = (unsigned *)(meshes + lod->n_levels);
+	unsigned i;
+	for (i = 0; i < lod->n_levels; i++) {
+		meshes[i] = &lod->levels[i].mesh;
+		res[i] = lod->levels[i].res;
+	}
+	const int retval = itgl_mesh_file_write(path, meshes, res, lod->n_levels);
+	TGL_FREE(meshes);
+	return retval;
+}
+
+TGLMeshLOD *tglutil_mesh_lod_load(const char *const path)
+{
+	FileView view;
+	uint32_t n_levels;
+	if (itgl_mesh_file_map(path, &view, &n_levels))
+		return NULL;
+	LoadedMeshLOD *const loaded =
+		TGL_MALLOC(sizeof(LoadedMeshLOD) + sizeof(LODLevel) * n_levels);
+	if (!loaded) {
+		itgl_file_unmap(&view);
+		return NULL;
+	}
+	loaded->lod = (TGLMeshLOD){
+		.n_levels = n_levels,
+		.levels = (LODLevel *)(loaded + 1),
+	};
+	uint32_t i;
+	for (i = 0; i < n_levels; i++) {
+		if (itgl_mesh_file_level(
+			    &view, i, &loaded->lod.levels[i].mesh, &loaded->lod.levels[i].res)) {
+			TGL_FREE(loaded);
+			itgl_file_unmap(&view);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	loaded->view = view;
+	return &loaded->lod;
+}
+
+void tglutil_mesh_lod_free(TGLMeshLOD *const lod)
+{
+	LoadedMeshLOD *const loaded = (LoadedMeshLOD *)lod;
+	itgl_file_unmap(&loaded->view);
+	TGL_FREE(loaded);
+}
+#endif /* ~TERMGL_MINIMAL */
+#endif /* TERMGL3D */
+
 #endif /* TERMGLUTIL */
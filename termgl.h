@@ -17,6 +17,7 @@ extern "C" {
 #define TGL_VERSION_MINOR 6
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(_WIN32) || defined(WIN32)
@@ -59,6 +60,8 @@ enum {
 	/* internal - DO NOT USE */
 	TGL_CULL_BIT = 0x80,
 #endif
+	/* buffers (cont.) */
+	TGL_HIZ_BUFFER = 0x100,
 };
 
 /**
@@ -98,6 +101,14 @@ typedef struct TGLPixFmt {
 	TGLFmt bkg;
 } TGLPixFmt;
 
+/**
+ * Character and colors of a single cell in the frame buffer
+ */
+typedef struct TGLPixel {
+	char v_char;
+	TGLPixFmt color;
+} TGLPixel;
+
 /**
  * @param fg: TGLFmt
  * @param [bkg]: TGLFmt
@@ -124,19 +135,60 @@ typedef struct TGLPixFmt {
 	TGL_GET_MACRO4(__VA_ARGS__, TGL_RGB4, TGL_RGB3, _2, _1, UNUSED)                            \
 	(__VA_ARGS__)
 
+/**
+ * Retained image which is composited over the frame buffer by tgl_flush
+ * Layers are owned by the context which created them. All fields except pixels may be changed between frames
+ */
+typedef struct TGLLayer {
+	int x; /**< position of the top-left corner */
+	int y;
+	int z; /**< layers with greater z are drawn over layers with smaller z */
+	unsigned width;
+	unsigned height;
+	char transparent; /**< pixels with this character are not drawn, '\0' for an opaque layer */
+	bool visible;
+	TGLPixel *pixels; /**< row-major array of width * height pixels */
+} TGLLayer;
+
 /**
  * Pixel shader that is called for each pixel in draw functions
  */
 typedef void TGLPixelShader(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
 
+/**
+ * Pixel shader that is called once for a run of count pixels on the same row
+ * @param uv: (u,v) of each pixel
+ * @param color: array of count colors to set
+ * @param c: array of count characters to set
+ */
+typedef void TGLSpanShader(
+	unsigned count, const uint8_t (*uv)[2], TGLPixFmt *color, char *c, const void *data);
+
+typedef struct TGLPixelShaderSpan {
+	TGLSpanShader *shader;
+	const void *data;
+} TGLPixelShaderSpan;
+
+/**
+ * Pixel shader that defers to a TGLSpanShader
+ * Filled triangles drawn with it shade each row's pixels that pass the depth test with one call
+ * @param data (TGLPixelShaderSpan *)
+ */
+void tgl_pixel_shader_span(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+
 #ifndef TERMGL_MINIMAL
 
 /**
  * Gradient of characters from dark to bright
+ * lut, if not NULL, holds the character for each of the 256 intensities (see tgl_gradient_lut)
+ * colors, if not NULL, holds a color for each of the 256 intensities, and overrides the fixed color
+ * of tgl_pixel_shader_simple
  */
 typedef struct TGLGradient {
 	unsigned length;
 	const char *grad;
+	const char *lut;
+	const TGLPixFmt *colors;
 } TGLGradient;
 
 typedef struct TGLPixelShaderSimple {
@@ -166,11 +218,61 @@ void tgl_pixel_shader_simple(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, co
  */
 void tgl_pixel_shader_texture(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
 
+/**
+ * Cell of a texture packed into a TGLAtlas
+ */
+typedef struct TGLTexel {
+	char c;
+	uint8_t color; /**< index into the atlas' palette */
+} TGLTexel;
+
+/**
+ * Textures packed into a single allocation, sharing a palette of up to 256 colors
+ */
+typedef struct TGLAtlas TGLAtlas;
+
+/**
+ * Texture within a TGLAtlas, which remains valid for as long as the atlas exists
+ */
+typedef struct TGLAtlasTexture {
+	const TGLTexel *texels; /**< first texel of the texture */
+	const TGLPixFmt *palette;
+	unsigned stride; /**< number of texels between the starts of consecutive rows */
+	uint16_t width;
+	uint16_t height;
+} TGLAtlasTexture;
+
+/**
+ * Packs textures into an atlas, replacing their colors with indices into its palette
+ * @param textures: array of count textures, which are copied
+ * @param out: array of count TGLAtlasTextures, set to the textures within the atlas
+ * @return: pointer to a TGLAtlas, NULL on failure
+ * On failure, errno is set to EINVAL if the textures have over 256 distinct colors, otherwise to value specified by:
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLAtlas *tgl_atlas_create(
+	const TGLPixelShaderTexture *textures, unsigned count, TGLAtlasTexture *out);
+
+void tgl_atlas_delete(TGLAtlas *atlas);
+
+/**
+ * Pixel shader that maps (u,v) onto a texture within an atlas
+ * @param data (TGLAtlasTexture *)
+ */
+void tgl_pixel_shader_atlas(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+
 /**
  * Gets a gradient's character corresponding to an intensity (i.e. u or v value)
  */
 char tgl_grad_char(const TGLGradient *grad, uint8_t intensity);
 
+/**
+ * Builds a gradient's intensity-to-character lookup table
+ * Assign the result to grad->lut to skip the per-fragment division in tgl_grad_char
+ * @param lut: array of 256 characters to fill
+ */
+void tgl_gradient_lut(const TGLGradient *grad, char *lut);
+
 #endif /* ~TERMGL_MINIMAL */
 
 /**
@@ -198,6 +300,7 @@ void tgl_delete(TGL *tgl);
 
 /**
  * Prints frame buffer to terminal
+ * Visible layers are first drawn onto the frame buffer
  * @return 0 on success, -1 on failure
  * On failure, errno is set to value specified by: https://man7.org/linux/man-pages/man3/fputc.3p.html#ERRORS
  */
@@ -207,7 +310,7 @@ int tgl_flush(TGL *tgl);
  * Clears buffers
  * @param buffers: bitwise combination of buffers:
  *   TGL_FRAME_BUFFER - frame buffer
- *   TGL_Z_BUFFER - depth buffer
+ *   TGL_Z_BUFFER - depth buffer (and hierarchical depth buffer, if enabled)
  *   TGL_OUTPUT_BUFFER - output buffer
  */
 void tgl_clear(TGL *tgl, uint8_t buffers);
@@ -219,10 +322,36 @@ void tgl_clear(TGL *tgl, uint8_t buffers);
  */
 int tgl_clear_screen(void);
 
+/**
+ * Creates a layer owned by the context
+ * The layer is visible, has z = 0, is positioned at (0, 0), and its transparent character is ' '
+ * Its pixels are initialized as in tgl_layer_clear
+ * @return: pointer to a TGLLayer, NULL on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLLayer *tgl_layer_create(TGL *tgl, unsigned width, unsigned height);
+
+/**
+ * Frees a layer. Layers which are not deleted are freed by tgl_delete
+ */
+void tgl_layer_delete(TGL *tgl, TGLLayer *layer);
+
+/**
+ * Sets all pixels of a layer to its transparent character, or ' ' if the layer is opaque
+ */
+void tgl_layer_clear(TGLLayer *layer);
+
+/**
+ * Prints a string onto a layer, at coordinates relative to its top-left corner
+ * Characters outside the layer are discarded
+ */
+void tgl_layer_puts(TGLLayer *layer, int x, int y, const char *str, TGLPixFmt color);
+
 /**
  * Enables or disables certain settings
  * @param settings: bitwise combination of settings:
  *   TGL_Z_BUFFER - depth buffer
+ *   TGL_HIZ_BUFFER - coarse per-tile depth buffer used to reject occluded triangles and spans before per-pixel depth tests. Only used while TGL_Z_BUFFER is enabled
  *   TGL_DOUBLE_WIDTH - display characters at double their standard widths (Limited support from terminal emulators. Should work on Windows Terminal, XTerm, and Konsole)
  *   TGL_DOUBLE_CHARS - square pixels by printing 2 characters per pixel
  *   TGL_CULL_FACE - (3D ONLY) cull specified triangle faces
@@ -231,17 +360,39 @@ int tgl_clear_screen(void);
  * @return 0 on success, -1 on failure
  * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
  */
-int tgl_enable(TGL *tgl, uint8_t settings);
-void tgl_disable(TGL *tgl, uint8_t settings);
+int tgl_enable(TGL *tgl, uint16_t settings);
+void tgl_disable(TGL *tgl, uint16_t settings);
+
+/**
+ * Restricts all drawing to the rectangle between (x0, y0) and (x1, y1), inclusive
+ * The rectangle is limited to the frame. Initially, it covers the entire frame
+ */
+void tgl_scissor(TGL *tgl, int x0, int y0, int x1, int y1);
 
 /**
  * Printing functions similar to those provided by stdio.h
+ * Characters outside the scissor rectangle are discarded
  */
 void tgl_putchar(TGL *tgl, int x, int y, char c, TGLPixFmt color);
 void tgl_puts(TGL *tgl, int x, int y, const char *str, TGLPixFmt color);
 
+/**
+ * Fills a width by height rectangle with top-left corner (x, y) with a character
+ * Like the printing functions, ignores the depth buffer and discards cells outside the scissor rectangle
+ */
+void tgl_rect_fill(
+	TGL *tgl, int x, int y, unsigned width, unsigned height, char c, TGLPixFmt color);
+
+/**
+ * Copies a width by height image with top-left corner (x, y) into the frame buffer
+ * Like the printing functions, ignores the depth buffer and discards cells outside the scissor rectangle
+ * @param pixels: row-major array of width * height pixels
+ */
+void tgl_blit(TGL *tgl, int x, int y, unsigned width, unsigned height, const TGLPixel *pixels);
+
 /**
  * Drawing functions
+ * Primitives are clipped to the scissor rectangle
  */
 void tgl_point(TGL *tgl, TGLVert v0, TGLPixelShader *t, const void *data);
 void tgl_line(TGL *tgl, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
@@ -250,6 +401,27 @@ void tgl_triangle(
 void tgl_triangle_fill(
 	TGL *tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *t, const void *data);
 
+/**
+ * Batched drawing functions
+ * Equivalent to repeatedly calling the corresponding drawing function, but with less overhead per primitive
+ * @param verts: buffer of TGLVert structs, which may be embedded in larger structs
+ * @param stride: distance in bytes between consecutive vertices, or 0 if vertices are tightly packed
+ * @param indices: indices of vertices to draw, or NULL to draw vertices in order
+ * @param count: number of vertices to draw, or number of indices if indices is not NULL
+ * tgl_points draws a point for every vertex
+ * tgl_lines draws a line for every pair of vertices
+ * tgl_line_strip draws a polyline connecting all vertices
+ * tgl_triangles draws a triangle for every three vertices
+ */
+void tgl_points(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, TGLPixelShader *t, const void *data);
+void tgl_lines(TGL *tgl, const void *verts, size_t stride, const unsigned *indices, unsigned count,
+	TGLPixelShader *t, const void *data);
+void tgl_line_strip(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, TGLPixelShader *t, const void *data);
+void tgl_triangles(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, bool fill, TGLPixelShader *t, const void *data);
+
 #ifdef TERMGL3D
 
 enum /* faces */ {
@@ -267,11 +439,57 @@ typedef float TGLVec3[3];
 typedef float TGLVec4[4];
 typedef TGLVec3 TGLTriangle[3];
 
+/**
+ * Indexed triangle mesh
+ */
+typedef struct TGLMesh {
+	const TGLVec3 *verts;
+	const uint8_t (*uvs)[2]; /**< uv of each vertex, or NULL */
+	const unsigned *indices; /**< 3 vertex indices per triangle */
+	const TGLVec3 *normals; /**< normal of each triangle, or NULL. See tgl_cull_matrix */
+	const TGLVec3 *vert_normals; /**< unit normal of each vertex, or NULL. See tgl_lighting */
+	unsigned n_verts;
+	unsigned n_triangles;
+	TGLVec3 aabb[2]; /**< minimum and maximum corners of the box computed by tgl_mesh_bounds */
+} TGLMesh;
+
 /**
  * Vertex shader that should transform an input vertex into Clip Space
  */
 typedef void TGLVertexShader(const TGLVec3 in, TGLVec4 out, const void *data);
 
+/**
+ * Vertex shader that should transform count input vertices into Clip Space
+ */
+typedef void TGLVertexShaderBatch(
+	const TGLVec3 *in, TGLVec4 *out, unsigned count, const void *data);
+
+/**
+ * Primitive shader that is run once per triangle, after culling, to determine the color and character of every one
+ * of its pixels
+ * @param in: vertices of the triangle before being transformed by the vertex shader
+ */
+typedef void TGLPrimitiveShader(const TGLVec3 in[3], TGLPixFmt *color, char *c, const void *data);
+
+/**
+ * Maximum number of varyings per vertex
+ */
+#define TGL_MAX_VARYINGS 16
+
+/**
+ * Vertex shader that should transform count input vertices into Clip Space, and output the varyings of each
+ * @param varyings: array into which the varyings of each vertex should be written consecutively
+ */
+typedef void TGLVertexShaderVaryings(
+	const TGLVec3 *in, TGLVec4 *out, float *varyings, unsigned count, const void *data);
+
+/**
+ * Pixel shader that is called for each pixel with the perspective-correct interpolation of the varyings output by a
+ * TGLVertexShaderVaryings
+ */
+typedef void TGLPixelShaderVaryings(
+	const float *varyings, TGLPixFmt *color, char *c, const void *data);
+
 #ifndef TERMGL_MINIMAL
 typedef struct TGLVertexShaderSimple {
 	TGLMat mat;
@@ -283,6 +501,13 @@ typedef struct TGLVertexShaderSimple {
  */
 void tgl_vertex_shader_simple(const TGLVec3 vert, TGLVec4 out, const void *data);
 
+/**
+ * Batch vertex shader that outputs the input vertices multiplied by a matrix, using SIMD instructions if available
+ * @param data (TGLVertexShaderSimple *)
+ */
+void tgl_vertex_shader_simple_batch(
+	const TGLVec3 *in, TGLVec4 *out, unsigned count, const void *data);
+
 /**
  * Transformation matrix generation functions
  */
@@ -308,6 +533,13 @@ void tgl_inv3(const float vec[3], float res[3]);
 void tgl_norm3(float vec[3]);
 
 void tgl_mulmatvec(const TGLMat mat, const TGLVec3 vec, TGLVec4 res);
+
+/**
+ * Multiplies count vectors (x[i], y[i], z[i], 1) by a matrix, storing the results in out_x, out_y, out_z, and out_w
+ * Uses the widest of AVX2, SSE2, or NEON supported by the CPU, falling back to scalar code
+ */
+void tgl_mulmatvec_soa(const TGLMat mat, const float *x, const float *y, const float *z,
+	unsigned count, float *out_x, float *out_y, float *out_z, float *out_w);
 void tgl_mulmat(const TGLMat mat1, const TGLMat mat2, TGLMat res);
 
 #endif /* ~TERMGL_MINIMAL */
@@ -324,6 +556,85 @@ void tgl_cross(const float vec1[3], const float vec2[3], float res[3]);
  */
 void tgl_cull_face(TGL *tgl, uint8_t settings);
 
+/**
+ * Enables backface culling in object space for meshes with normals drawn by tgl_draw_mesh
+ * Back faces are then culled before vertex shading, using the eye position in object space. Requires
+ * tgl_enable(TGL_CULL_FACE)
+ * Normals must point the same way as the cross product (v1 - v0) x (v2 - v0) of their triangle's vertices
+ * @param mat: matrix used by the vertex shader to transform vertices into Clip Space, or NULL to disable
+ */
+void tgl_cull_matrix(TGL *tgl, const TGLMat mat);
+
+/**
+ * Sets the primitive shader used to flat shade triangles rendered by 3D functions
+ * While a primitive shader is set, the pixel shaders passed into 3D functions are ignored, and may be NULL
+ * @param shader: primitive shader, or NULL to use pixel shaders
+ */
+void tgl_primitive_shader(TGL *tgl, TGLPrimitiveShader *shader, const void *data);
+
+#ifndef TERMGL_MINIMAL
+/**
+ * Light source, in the same space as the vertices of the meshes it lights
+ */
+typedef struct TGLLight {
+	TGLVec3 vec; /**< unit direction of a directional light, or position of a point light */
+	float intensity;
+	bool point;
+} TGLLight;
+
+typedef struct TGLLighting {
+	const TGLLight *lights;
+	unsigned n_lights;
+	float ambient; /**< intensity received by every vertex */
+	TGLPixelShaderSimple shade; /**< color, and gradient indexed by total intensity in [0, 1] */
+} TGLLighting;
+
+/**
+ * Sets the lighting used to Gouraud shade meshes with vertex normals drawn by tgl_draw_mesh and the functions built
+ * on it
+ * Light is computed once per vertex, interpolated across triangles, and mapped onto lighting's gradient, so the pixel
+ * shaders passed in when drawing such meshes are ignored. The meshes' uvs are not used
+ * Lights are not transformed, so each instance drawn by tgl_draw_mesh_instanced receives the same light in its own
+ * object space
+ * @param lighting: lighting which must remain valid while set, or NULL to disable
+ */
+void tgl_lighting(TGL *tgl, const TGLLighting *lighting);
+
+/**
+ * Computes the normal of each of a mesh's vertices as the normalized, area-weighted sum of the normals of the
+ * triangles using it
+ * @param normals: array of mesh->n_verts normals, which may be assigned to mesh->vert_normals
+ */
+void tgl_mesh_vertex_normals(const TGLMesh *mesh, TGLVec3 *normals);
+
+/**
+ * Texture with precomputed mip levels
+ */
+typedef struct TGLTexture TGLTexture;
+
+/**
+ * Creates a texture and its mip levels, each of which halves the resolution of the previous one by keeping the most
+ * common character and color of each 2x2 block of texels
+ * @param width, height: powers of two no greater than 256
+ * @param chars, colors: row-major arrays of width * height texels, which are copied
+ * @return: pointer to a TGLTexture, NULL on failure
+ * On failure, errno is set to EINVAL if width or height is invalid, otherwise to value specified by:
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLTexture *tgl_texture_create(
+	unsigned width, unsigned height, const char *chars, const TGLPixFmt *colors);
+
+void tgl_texture_delete(TGLTexture *texture);
+
+/**
+ * Sets the texture sampled at the UVs of triangles rendered by 3D functions, instead of calling their pixel shaders
+ * Each triangle samples the mip level whose texels best match the size of its cells on screen
+ * Primitive shaders take precedence over textures, and textures over lighting
+ * @param texture: texture which must remain valid while set, or NULL to use pixel shaders
+ */
+void tgl_texture(TGL *tgl, const TGLTexture *texture);
+#endif /* ~TERMGL_MINIMAL */
+
 /**
  * Renders triangle onto framebuffer
  */
@@ -331,12 +642,180 @@ void tgl_triangle_3d(TGL *tgl, const TGLTriangle in, const uint8_t (*uv)[2], boo
 	TGLVertexShader *vert_shader, const void *vert_data, TGLPixelShader *frag_shader,
 	const void *frag_data);
 
+/**
+ * Renders count triangles onto framebuffer, transforming their vertices with a batch vertex shader
+ * @param uv: UVs of each triangle, or NULL
+ */
+void tgl_triangles_3d(TGL *tgl, const TGLTriangle *in, const uint8_t (*uv)[3][2], unsigned count,
+	bool fill, TGLVertexShaderBatch *vert_shader, const void *vert_data,
+	TGLPixelShader *frag_shader, const void *frag_data);
+
+/**
+ * Renders a triangle strip onto framebuffer, in which each vertex after the first two forms a triangle with the
+ * two preceding it. Every vertex is transformed by the vertex shader just once
+ * Triangles keep the winding order of the first, as every other triangle is flipped
+ * @param count: number of vertices
+ * @param uv: UV of each vertex, or NULL
+ */
+void tgl_triangle_strip_3d(TGL *tgl, const TGLVec3 *in, const uint8_t (*uv)[2], unsigned count,
+	bool fill, TGLVertexShaderBatch *vert_shader, const void *vert_data,
+	TGLPixelShader *frag_shader, const void *frag_data);
+
+/**
+ * Renders a triangle fan onto framebuffer, in which each vertex after the first two forms a triangle with the
+ * preceding vertex and the first vertex. Every vertex is transformed by the vertex shader just once
+ * @param count: number of vertices
+ * @param uv: UV of each vertex, or NULL
+ */
+void tgl_triangle_fan_3d(TGL *tgl, const TGLVec3 *in, const uint8_t (*uv)[2], unsigned count,
+	bool fill, TGLVertexShaderBatch *vert_shader, const void *vert_data,
+	TGLPixelShader *frag_shader, const void *frag_data);
+
+/**
+ * Renders an indexed mesh onto framebuffer
+ * Each vertex is transformed by the vertex shader once, regardless of how many triangles share it
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_draw_mesh(TGL *tgl, const TGLMesh *mesh, bool fill, TGLVertexShaderBatch *vert_shader,
+	const void *vert_data, TGLPixelShader *frag_shader, const void *frag_data);
+
+/**
+ * Renders count filled triangles onto framebuffer, interpolating the varyings output by the vertex shader across
+ * them with perspective correction
+ * Primitive shaders, lighting, and textures do not apply to these triangles
+ * @param n_varyings: number of varyings per vertex, at most TGL_MAX_VARYINGS
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if n_varyings exceeds TGL_MAX_VARYINGS
+ */
+int tgl_triangles_3d_varyings(TGL *tgl, const TGLTriangle *in, unsigned count, unsigned n_varyings,
+	TGLVertexShaderVaryings *vert_shader, const void *vert_data,
+	TGLPixelShaderVaryings *frag_shader, const void *frag_data);
+
+/**
+ * Renders an indexed mesh onto framebuffer as filled triangles, interpolating the varyings output by the vertex
+ * shader across them with perspective correction
+ * Each vertex is transformed by the vertex shader once. Primitive shaders, lighting, and textures do not apply to
+ * the mesh
+ * @param n_varyings: number of varyings per vertex, at most TGL_MAX_VARYINGS
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if n_varyings exceeds TGL_MAX_VARYINGS, otherwise to value specified by:
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_draw_mesh_varyings(TGL *tgl, const TGLMesh *mesh, unsigned n_varyings,
+	TGLVertexShaderVaryings *vert_shader, const void *vert_data,
+	TGLPixelShaderVaryings *frag_shader, const void *frag_data);
+
+/**
+ * Computes the bounding box of a mesh's vertices, storing it in mesh->aabb
+ * Must be called again whenever the vertices change
+ */
+void tgl_mesh_bounds(TGLMesh *mesh);
+
+#ifndef TERMGL_MINIMAL
+/**
+ * Tests whether an axis-aligned bounding box may be visible by transforming only its 8 corners
+ * The test is conservative: boxes intersecting the view volume are always reported as visible, while some boxes
+ * which lie just outside of it near its corners may be as well
+ * @param aabb: minimum and maximum corners of the box
+ * @param mat: matrix transforming the box into Clip Space, i.e. the matrix used by the vertex shader
+ */
+bool tgl_aabb_visible(const TGLVec3 aabb[2], const TGLMat mat);
+
+/**
+ * Tests whether a mesh may be visible using its bounding box, without transforming the mesh's vertices
+ * Meshes which are not visible need not be drawn
+ * Requires mesh->aabb to have been computed by tgl_mesh_bounds
+ * @param mat: matrix transforming the mesh into Clip Space
+ */
+bool tgl_mesh_visible(const TGLMesh *mesh, const TGLMat mat);
+
+/**
+ * Static scene, stored as a bounding volume hierarchy over the triangles of its meshes
+ */
+typedef struct TGLScene TGLScene;
+
+/**
+ * Builds a scene from meshes, copying their vertices, UVs, and indices
+ * The meshes are not referenced by the scene once it has been created
+ * If there are no triangles, the scene is empty and drawing it draws nothing
+ * @return: pointer to a TGLScene, NULL on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLScene *tgl_scene_create(const TGLMesh *meshes, unsigned count);
+
+void tgl_scene_delete(TGLScene *scene);
+
+/**
+ * Renders the parts of a scene which may be visible onto framebuffer
+ * Parts outside the view volume are culled without being transformed by the vertex shader, as are parts hidden by
+ * the hierarchical depth buffer if TGL_HIZ_BUFFER is enabled. Nearer parts are drawn first
+ * If TGL_CULL_FACE is enabled, back faces are culled in object space before vertex shading, as with tgl_cull_matrix
+ * @param mat: matrix transforming the scene into Clip Space, i.e. the matrix used by the vertex shader
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_scene_draw(TGL *tgl, const TGLScene *scene, const TGLMat mat, bool fill,
+	TGLVertexShaderBatch *vert_shader, const void *vert_data, TGLPixelShader *frag_shader,
+	const void *frag_data);
+
+/**
+ * Mesh with precomputed levels of detail
+ */
+typedef struct TGLMeshLOD TGLMeshLOD;
+
+/**
+ * Precomputes simplified versions of a mesh by merging nearby vertices
+ * Level 0 is the mesh itself, which must remain valid for as long as the TGLMeshLOD exists. Level i > 0 merges all
+ * vertices within the same cell of a grid dividing the mesh's longest side into (256 >> (i - 1)) cells
+ * @param n_levels: maximum number of levels, including the original mesh
+ * @return: pointer to a TGLMeshLOD, NULL on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLMeshLOD *tgl_mesh_lod_create(const TGLMesh *mesh, unsigned n_levels);
+
+void tgl_mesh_lod_delete(TGLMeshLOD *lod);
+
+/**
+ * Selects the coarsest level of detail whose merged vertices are less than a cell apart on screen
+ * @param mat: matrix transforming the mesh into Clip Space
+ * @return: mesh of the selected level, NULL if the mesh is not visible
+ */
+const TGLMesh *tgl_mesh_lod_select(const TGL *tgl, const TGLMeshLOD *lod, const TGLMat mat);
+
+/**
+ * Renders the level of detail selected by tgl_mesh_lod_select onto framebuffer
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_mesh_lod_draw(TGL *tgl, const TGLMeshLOD *lod, const TGLMat mat, bool fill,
+	TGLVertexShaderBatch *vert_shader, const void *vert_data, TGLPixelShader *frag_shader,
+	const void *frag_data);
+
+/**
+ * Renders count instances of a mesh onto framebuffer, each with its own transformation
+ * Instances outside the view volume, or hidden by the hierarchical depth buffer if TGL_HIZ_BUFFER is enabled, are
+ * culled without being transformed by the vertex shader. If TGL_CULL_FACE is enabled and the mesh has normals, back
+ * faces are culled in object space, as with tgl_cull_matrix
+ * Requires mesh->aabb to have been computed by tgl_mesh_bounds
+ * @param mats: matrix transforming each instance into Clip Space
+ * @param vert_data: data of the first instance's vertex shader, or NULL to pass each instance's matrix as
+ *   (TGLVertexShaderSimple *), as expected by tgl_vertex_shader_simple_batch
+ * @param vert_stride: distance in bytes between the vertex shader data of consecutive instances, 0 to share it
+ * @param frag_data: data of the first instance's pixel shader
+ * @param frag_stride: distance in bytes between the pixel shader data of consecutive instances, 0 to share it
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_draw_mesh_instanced(TGL *tgl, const TGLMesh *mesh, const TGLMat *mats, unsigned count,
+	bool fill, TGLVertexShaderBatch *vert_shader, const void *vert_data, size_t vert_stride,
+	TGLPixelShader *frag_shader, const void *frag_data, size_t frag_stride);
+#endif /* ~TERMGL_MINIMAL */
+
 #endif /* TERMGL3D */
 
 #ifdef TERMGLUTIL
 
-#include <stddef.h>
-
 #ifdef __unix__
 #include <unistd.h>
 #define TGL_SSIZE_T ssize_t
@@ -435,6 +914,94 @@ int tglutil_set_echo_input(bool enabled);
  */
 int tglutil_set_mouse_tracking_enabled(bool enabled);
 
+#ifdef TERMGL3D
+/**
+ * Loads a binary STL file into an indexed mesh by memory-mapping it
+ * Vertices with identical coordinates are merged, and the bounding box is computed
+ * The STL face normals are ignored, and the mesh's normals are computed from the winding of its triangles instead
+ * @return: pointer to a mesh which must be freed with tglutil_mesh_free, NULL on failure
+ * On failure, errno is set to EINVAL if the file is not a binary STL file, otherwise to value specified by:
+ *   UNIX:
+ *     https://man7.org/linux/man-pages/man2/open.2.html#ERRORS
+ *     https://man7.org/linux/man-pages/man2/fstat.2.html#ERRORS
+ *     https://man7.org/linux/man-pages/man2/mmap.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLMesh *tglutil_mesh_load_stl(const char *path);
+
+/**
+ * Loads a Wavefront OBJ file into an indexed mesh by memory-mapping it
+ * Polygons are triangulated as fans, and corners with the same position, texture coordinate, and normal indices share a vertex
+ * Texture coordinates are clamped to [0,1] and quantized to uvs, with v=1 at the top row (v=0) of a texture
+ * Normals are normalized and stored as vert_normals. uvs and vert_normals are NULL if the file has no texture coordinates or normals respectively
+ * @return: pointer to a mesh which must be freed with tglutil_mesh_free, NULL on failure
+ * On failure, errno is set to EINVAL if the file cannot be parsed, otherwise to value specified by:
+ *   UNIX:
+ *     https://man7.org/linux/man-pages/man2/open.2.html#ERRORS
+ *     https://man7.org/linux/man-pages/man2/fstat.2.html#ERRORS
+ *     https://man7.org/linux/man-pages/man2/mmap.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLMesh *tglutil_mesh_load_obj(const char *path);
+
+/**
+ * Writes a mesh to a binary mesh file, which tglutil_mesh_load can use without parsing
+ * The file stores the mesh's arrays, index buffer, and bounding box in the memory layout of the current machine
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by:
+ *   https://man7.org/linux/man-pages/man3/fopen.3p.html#ERRORS
+ *   https://man7.org/linux/man-pages/man3/fwrite.3p.html#ERRORS
+ *   https://man7.org/linux/man-pages/man3/fclose.3p.html#ERRORS
+ */
+int tglutil_mesh_save(const char *path, const TGLMesh *mesh);
+
+/**
+ * Loads the finest level of a binary mesh file by memory-mapping it, with the mesh's arrays pointing into the file
+ * The file's layout and vertex indices are validated, so a corrupt file cannot cause out-of-bounds reads when drawing
+ * The file must have been written by tglutil_mesh_save or tglutil_mesh_lod_save on a machine with the same byte order
+ * @return: pointer to a mesh which must be freed with tglutil_mesh_free, NULL on failure
+ * On failure, errno is set to EINVAL if the file is not a valid binary mesh file, otherwise to value specified by:
+ *   UNIX:
+ *     https://man7.org/linux/man-pages/man2/open.2.html#ERRORS
+ *     https://man7.org/linux/man-pages/man2/fstat.2.html#ERRORS
+ *     https://man7.org/linux/man-pages/man2/mmap.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLMesh *tglutil_mesh_load(const char *path);
+
+/**
+ * Frees a mesh returned by a tglutil_mesh_load* function
+ */
+void tglutil_mesh_free(TGLMesh *mesh);
+
+#ifndef TERMGL_MINIMAL
+/**
+ * Writes all levels of detail to a binary mesh file
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by:
+ *   https://man7.org/linux/man-pages/man3/fopen.3p.html#ERRORS
+ *   https://man7.org/linux/man-pages/man3/fwrite.3p.html#ERRORS
+ *   https://man7.org/linux/man-pages/man3/fclose.3p.html#ERRORS
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tglutil_mesh_lod_save(const char *path, const TGLMeshLOD *lod);
+
+/**
+ * Loads all levels of a binary mesh file by memory-mapping it, as with tglutil_mesh_load
+ * A file written by tglutil_mesh_save has a single level
+ * @return: pointer to a TGLMeshLOD which must be freed with tglutil_mesh_lod_free instead of tgl_mesh_lod_delete,
+ *   NULL on failure
+ * On failure, errno is set as by tglutil_mesh_load
+ */
+TGLMeshLOD *tglutil_mesh_lod_load(const char *path);
+
+void tglutil_mesh_lod_free(TGLMeshLOD *lod);
+#endif /* ~TERMGL_MINIMAL */
+#endif /* TERMGL3D */
+
 #endif /* TERMGLUTIL */
 
 /**
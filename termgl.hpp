@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2021-2025 Wojciech Graj
+ *
+ * Licensed under the MIT license: https://opensource.org/licenses/MIT
+ * Permission is granted to use, copy, modify, and redistribute the work.
+ * Full license information available in the project LICENSE file.
+ **/
+
+#ifndef TERMGL_HPP
+#define TERMGL_HPP
+
+#include "termgl.h"
+
+/**
+ * C++ drawing functions taking shaders as functors or lambdas
+ * Pixel shaders are called as shader(u, v, color, c) with uint8_t u, v, TGLPixFmt &color, char &c
+ * Vertex shaders are called as shader(in, out) with const float *in (TGLVec3), float *out (TGLVec4)
+ * Shaders are inlined into loops over spans of pixels and batches of vertices, which are passed to
+ * the C drawing functions as a TGLSpanShader and TGLVertexShaderBatch respectively
+ * Shaders must outlive the call to the drawing function
+ */
+namespace tgl {
+
+/**
+ * TGLSpanShader which calls a pixel shader functor for each pixel
+ * @param data (const Shader *)
+ */
+template <typename Shader>
+void span_shader(const unsigned count, const uint8_t (*const uv)[2], TGLPixFmt *const color,
+	char *const c, const void *const data)
+{
+	const Shader &shader = *static_cast<const Shader *>(data);
+	for (unsigned i = 0; i < count; i++)
+		shader(uv[i][0], uv[i][1], color[i], c[i]);
+}
+
+/**
+ * Data for tgl_pixel_shader_span which calls a pixel shader functor
+ */
+template <typename Shader> inline TGLPixelShaderSpan pixel_shader_span(const Shader &shader)
+{
+	const TGLPixelShaderSpan span = { &span_shader<Shader>, &shader };
+	return span;
+}
+
+template <typename Shader> inline void point(TGL *tgl, TGLVert v0, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_point(tgl, v0, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader> inline void line(TGL *tgl, TGLVert v0, TGLVert v1, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_line(tgl, v0, v1, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader>
+inline void triangle(TGL *tgl, TGLVert v0, TGLVert v1, TGLVert v2, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_triangle(tgl, v0, v1, v2, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader>
+inline void triangle_fill(TGL *tgl, TGLVert v0, TGLVert v1, TGLVert v2, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_triangle_fill(tgl, v0, v1, v2, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader>
+inline void points(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_points(tgl, verts, stride, indices, count, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader>
+inline void lines(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_lines(tgl, verts, stride, indices, count, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader>
+inline void line_strip(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_line_strip(tgl, verts, stride, indices, count, &tgl_pixel_shader_span, &span);
+}
+
+template <typename Shader>
+inline void triangles(TGL *tgl, const void *verts, size_t stride, const unsigned *indices,
+	unsigned count, bool fill, const Shader &shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(shader);
+	tgl_triangles(tgl, verts, stride, indices, count, fill, &tgl_pixel_shader_span, &span);
+}
+
+#ifndef TERMGL_MINIMAL
+/**
+ * Equivalent of tgl_pixel_shader_simple, holding a copy of its data
+ */
+class PixelShaderSimple {
+public:
+	explicit PixelShaderSimple(const TGLPixelShaderSimple &simple) : simple(simple)
+	{
+	}
+
+	void operator()(const uint8_t u, const uint8_t v, TGLPixFmt &color, char &c) const
+	{
+		const TGLGradient &grad = *simple.grad;
+		const uint8_t intensity = static_cast<uint8_t>(u + v);
+		color = grad.colors ? grad.colors[intensity] : simple.color;
+		c = grad.lut ? grad.lut[intensity] : grad.grad[grad.length * intensity / 256U];
+	}
+
+private:
+	const TGLPixelShaderSimple simple;
+};
+
+/**
+ * Equivalent of tgl_pixel_shader_texture, holding a copy of its data
+ */
+class PixelShaderTexture {
+public:
+	explicit PixelShaderTexture(const TGLPixelShaderTexture &texture) : texture(texture)
+	{
+	}
+
+	void operator()(const uint8_t u, const uint8_t v, TGLPixFmt &color, char &c) const
+	{
+		const unsigned idx = u * texture.width / 256
+			+ texture.width * (v * texture.height / 256);
+		color = texture.colors[idx];
+		c = texture.chars[idx];
+	}
+
+private:
+	const TGLPixelShaderTexture texture;
+};
+
+/**
+ * Equivalent of tgl_pixel_shader_atlas, holding a copy of its data
+ */
+class PixelShaderAtlas {
+public:
+	explicit PixelShaderAtlas(const TGLAtlasTexture &texture) : texture(texture)
+	{
+	}
+
+	void operator()(const uint8_t u, const uint8_t v, TGLPixFmt &color, char &c) const
+	{
+		const TGLTexel texel = texture.texels[((v * texture.height) >> 8) * texture.stride
+			+ ((u * texture.width) >> 8)];
+		color = texture.palette[texel.color];
+		c = texel.c;
+	}
+
+private:
+	const TGLAtlasTexture texture;
+};
+#endif /* ~TERMGL_MINIMAL */
+
+#ifdef TERMGL3D
+/**
+ * TGLVertexShader which calls a vertex shader functor
+ * @param data (const Shader *)
+ */
+template <typename Shader> void vertex_shader(const TGLVec3 in, TGLVec4 out, const void *const data)
+{
+	(*static_cast<const Shader *>(data))(in, out);
+}
+
+/**
+ * TGLVertexShaderBatch which calls a vertex shader functor for each vertex
+ * @param data (const Shader *)
+ */
+template <typename Shader>
+void vertex_shader_batch(
+	const TGLVec3 *const in, TGLVec4 *const out, const unsigned count, const void *const data)
+{
+	const Shader &shader = *static_cast<const Shader *>(data);
+	for (unsigned i = 0; i < count; i++)
+		shader(in[i], out[i]);
+}
+
+template <typename VertShader, typename FragShader>
+inline void triangle_3d(TGL *tgl, const TGLTriangle in, const uint8_t (*uv)[2], bool fill,
+	const VertShader &vert_shader, const FragShader &frag_shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(frag_shader);
+	tgl_triangle_3d(tgl, in, uv, fill, &vertex_shader<VertShader>, &vert_shader,
+		&tgl_pixel_shader_span, &span);
+}
+
+template <typename VertShader, typename FragShader>
+inline void triangles_3d(TGL *tgl, const TGLTriangle *in, const uint8_t (*uv)[3][2],
+	unsigned count, bool fill, const VertShader &vert_shader, const FragShader &frag_shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(frag_shader);
+	tgl_triangles_3d(tgl, in, uv, count, fill, &vertex_shader_batch<VertShader>, &vert_shader,
+		&tgl_pixel_shader_span, &span);
+}
+
+template <typename VertShader, typename FragShader>
+inline void triangle_strip_3d(TGL *tgl, const TGLVec3 *in, const uint8_t (*uv)[2], unsigned count,
+	bool fill, const VertShader &vert_shader, const FragShader &frag_shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(frag_shader);
+	tgl_triangle_strip_3d(tgl, in, uv, count, fill, &vertex_shader_batch<VertShader>,
+		&vert_shader, &tgl_pixel_shader_span, &span);
+}
+
+template <typename VertShader, typename FragShader>
+inline void triangle_fan_3d(TGL *tgl, const TGLVec3 *in, const uint8_t (*uv)[2], unsigned count,
+	bool fill, const VertShader &vert_shader, const FragShader &frag_shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(frag_shader);
+	tgl_triangle_fan_3d(tgl, in, uv, count, fill, &vertex_shader_batch<VertShader>,
+		&vert_shader, &tgl_pixel_shader_span, &span);
+}
+
+/**
+ * @return: 0 on success, -1 on failure
+ * On failure, errno is set to value specified by:
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+template <typename VertShader, typename FragShader>
+inline int draw_mesh(TGL *tgl, const TGLMesh *mesh, bool fill, const VertShader &vert_shader,
+	const FragShader &frag_shader)
+{
+	const TGLPixelShaderSpan span = pixel_shader_span(frag_shader);
+	return tgl_draw_mesh(tgl, mesh, fill, &vertex_shader_batch<VertShader>, &vert_shader,
+		&tgl_pixel_shader_span, &span);
+}
+
+#ifndef TERMGL_MINIMAL
+/**
+ * Equivalent of tgl_vertex_shader_simple, holding a copy of its data
+ */
+class VertexShaderSimple {
+public:
+	explicit VertexShaderSimple(const TGLVertexShaderSimple &simple) : simple(simple)
+	{
+	}
+
+	void operator()(const float *const in, float *const out) const
+	{
+		for (unsigned i = 0; i < 4; i++)
+			out[i] = simple.mat[i][0] * in[0] + simple.mat[i][1] * in[1]
+				+ simple.mat[i][2] * in[2] + simple.mat[i][3];
+	}
+
+private:
+	const TGLVertexShaderSimple simple;
+};
+#endif /* ~TERMGL_MINIMAL */
+#endif /* TERMGL3D */
+
+} /* namespace tgl */
+
+#endif /* TERMGL_HPP */
@@ -22,12 +22,6 @@
 #include <time.h>
 #endif
 
-typedef struct STLTriangle {
-	float normal[3]; //normal is unreliable so it is not used.
-	float vertices[3][3];
-	uint16_t attribute_bytes; //attribute bytes is unreliable so it is not used.
-} __attribute__((packed)) STLTriangle;
-
 #define xstr(str_) str(str_)
 #define str(str_) #str_
 
@@ -64,8 +58,8 @@ static const uint8_t colors[] = {
 	TGL_WHITE,
 };
 
-static void teapot_pixel_shader(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
-static uint32_t stl_load(FILE *file, TGLTriangle **triangles);
+static void teapot_primitive_shader(
+	const TGLVec3 in[3], TGLPixFmt *color, char *c, const void *data);
 static uint8_t rgb_map_circle(int dx, int dy);
 static void sleep_ms(unsigned long ms);
 
@@ -77,11 +71,10 @@ static void demo_texture(unsigned res_x, unsigned res_y, unsigned frametime_ms);
 static void demo_rgb(unsigned res_x, unsigned res_y, unsigned frametime_ms);
 static void demo_mouse(unsigned res_x, unsigned res_y, unsigned frametime_ms);
 
-void teapot_pixel_shader(const uint8_t u, const uint8_t v, TGLPixFmt *const color, char *const c,
-	const void *const data)
+void teapot_primitive_shader(
+	const TGLVec3 in[3], TGLPixFmt *const color, char *const c, const void *const data)
 {
 	const TGLVec3 light_direction = { 1.F, 0.F, 0.F };
-	const TGLVec3 *const in = (const TGLVec3 *)data;
 	TGLVec3 ab, ac, cp;
 	tgl_sub3v(in[1], in[0], ab);
 	tgl_sub3v(in[2], in[0], ac);
@@ -95,29 +88,7 @@ void teapot_pixel_shader(const uint8_t u, const uint8_t v, TGLPixFmt *const colo
 			acosf(dp / (tgl_mag3(cp) * tgl_mag3(light_direction))) / -3.14159F + 1.F;
 	*color = TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD));
 	*c = tgl_grad_char(&tgl_gradient_min, light_mul * 255);
-	(void)u;
-	(void)v;
-}
-
-uint32_t stl_load(FILE *const file, TGLTriangle **const triangles)
-{
-	//ensure that file is binary instead of ascii
-	char header[5];
-	assert(fread(header, sizeof(char), 5, file) == 5);
-	assert(strncmp("solid", header, 5));
-
-	assert(fseek(file, sizeof(uint8_t[80]), SEEK_SET) == 0);
-	uint32_t num_triangles;
-	assert(fread(&num_triangles, sizeof(uint32_t), 1, file) == 1);
-	*triangles = malloc(sizeof(TGLTriangle[num_triangles]));
-
-	uint32_t i;
-	for (i = 0; i < num_triangles; i++) {
-		STLTriangle stl_triangle;
-		assert(fread(&stl_triangle, sizeof(STLTriangle), 1, file) == 1);
-		memcpy((*triangles)[i], stl_triangle.vertices, sizeof(float[3][3]));
-	}
-	return num_triangles;
+	(void)data;
 }
 
 void sleep_ms(const unsigned long ms)
@@ -209,6 +180,7 @@ void demo_teapot(const unsigned res_x, const unsigned res_y, const unsigned fram
 	TGL *const tgl = tgl_init(res_x, res_y);
 	assert(tgl);
 	tgl_cull_face(tgl, TGL_BACK | TGL_CCW);
+	tgl_primitive_shader(tgl, &teapot_primitive_shader, NULL);
 	assert(!tgl_enable(tgl,
 		TGL_DOUBLE_CHARS | TGL_CULL_FACE | TGL_Z_BUFFER | TGL_OUTPUT_BUFFER
 			| TGL_PROGRESSIVE));
@@ -216,12 +188,9 @@ void demo_teapot(const unsigned res_x, const unsigned res_y, const unsigned fram
 	TGLMat camera;
 	tgl_camera(camera, res_x, res_y, 1.57F, 0.1F, 5.F);
 
-	// Load triangles
-	TGLTriangle *trigs;
-	FILE *const stl_file = fopen("utah_teapot.stl", "rb");
-	assert(stl_file);
-	const uint32_t n_trigs = stl_load(stl_file, &trigs);
-	assert(!fclose(stl_file));
+	// Load mesh
+	TGLMesh *const mesh = tglutil_mesh_load_stl("utah_teapot.stl");
+	assert(mesh);
 
 	TGLMat temp;
 
@@ -241,42 +210,22 @@ void demo_teapot(const unsigned res_x, const unsigned res_y, const unsigned fram
 	const float dn = 0.02F;
 	float n = 0;
 
-	// Determine UVs for triangle vertices
-	const uint8_t uv[3][2] = {
-		{
-			0,
-			0,
-		},
-		{
-			255,
-			0,
-		},
-		{
-			0,
-			255,
-		},
-	};
-
 	while (1) {
 		//Edit transformation to move objects
 		tgl_rotate(obj_rotate, 0.F, 0.F, n);
 		tgl_mulmat((const TGLVec4 *)obj_translate, (const TGLVec4 *)obj_scale, temp);
 		tgl_mulmat((const TGLVec4 *)temp, (const TGLVec4 *)obj_rotate, obj_t);
 
-		unsigned i;
-		for (i = 0; i < n_trigs; i++) {
-			// Generate final transformation matrix
-			TGLMat to_view;
-			TGLVertexShaderSimple vertex_shader_data;
-			tgl_mulmat((const TGLVec4 *)camera_t, (const TGLVec4 *)obj_t, to_view);
-			tgl_mulmat((const TGLVec4 *)camera, (const TGLVec4 *)to_view,
-				vertex_shader_data.mat);
+		// Generate final transformation matrix
+		TGLMat to_view;
+		TGLVertexShaderSimple vertex_shader_data;
+		tgl_mulmat((const TGLVec4 *)camera_t, (const TGLVec4 *)obj_t, to_view);
+		tgl_mulmat(
+			(const TGLVec4 *)camera, (const TGLVec4 *)to_view, vertex_shader_data.mat);
 
-			// Draw to framebuffer
-			tgl_triangle_3d(tgl, (const TGLVec3 *)trigs[i], uv, true,
-				&tgl_vertex_shader_simple, &vertex_shader_data,
-				&teapot_pixel_shader, &trigs[i]);
-		}
+		// Draw to framebuffer
+		assert(!tgl_draw_mesh(tgl, mesh, true, &tgl_vertex_shader_simple_batch,
+			&vertex_shader_data, NULL, NULL));
 
 		assert(!tgl_flush(tgl));
 		tgl_clear(tgl, TGL_FRAME_BUFFER | TGL_Z_BUFFER | TGL_OUTPUT_BUFFER);
@@ -287,7 +236,7 @@ void demo_teapot(const unsigned res_x, const unsigned res_y, const unsigned fram
 	}
 
 	tgl_delete(tgl);
-	free(trigs);
+	tglutil_mesh_free(mesh);
 }
 
 void demo_keyboard(const unsigned res_x, const unsigned res_y, const unsigned frametime_ms)
@@ -395,57 +344,31 @@ static void demo_texture(const unsigned res_x, const unsigned res_y, const unsig
 	tgl_translate(translate, -.5F, -.5F, -.5F);
 	tgl_translate(translate2, 0.F, 0.F, 1.3F);
 
-	// Create texture
-	const TGLPixelShaderTexture tex = {
-		.width = 6,
-		.height = 6,
-		.chars = "\
-######\
-# 1 2#\
-#3 4 #\
-# 5 6#\
-#7 8 #\
-######",
-		.colors =
-			(TGLPixFmt[]){
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_RED, TGL_BOLD | TGL_UNDERLINE)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_GREEN, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_YELLOW, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_BLUE, TGL_BOLD | TGL_UNDERLINE)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_PURPLE, TGL_BOLD | TGL_UNDERLINE)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_CYAN, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_GREEN, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_RED, TGL_BOLD | TGL_UNDERLINE)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-				TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD)),
-			},
-	};
+	// Create texture, whose mip levels are used when the cube is small on screen
+	const char *const tex_chars = "\
+########\
+#      #\
+# 1  2 #\
+#  3  4#\
+# 5  6 #\
+#  7  8#\
+#      #\
+########";
+	TGLPixFmt tex_colors[64];
+	unsigned i;
+	for (i = 0; i < 64; i++)
+		tex_colors[i] = TGL_PIXFMT(TGL_IDX(TGL_WHITE, TGL_BOLD));
+	tex_colors[2 * 8 + 2] = TGL_PIXFMT(TGL_IDX(TGL_RED, TGL_BOLD | TGL_UNDERLINE));
+	tex_colors[2 * 8 + 5] = TGL_PIXFMT(TGL_IDX(TGL_GREEN, TGL_BOLD));
+	tex_colors[3 * 8 + 3] = TGL_PIXFMT(TGL_IDX(TGL_YELLOW, TGL_BOLD));
+	tex_colors[3 * 8 + 6] = TGL_PIXFMT(TGL_IDX(TGL_BLUE, TGL_BOLD | TGL_UNDERLINE));
+	tex_colors[4 * 8 + 2] = TGL_PIXFMT(TGL_IDX(TGL_PURPLE, TGL_BOLD | TGL_UNDERLINE));
+	tex_colors[4 * 8 + 5] = TGL_PIXFMT(TGL_IDX(TGL_CYAN, TGL_BOLD));
+	tex_colors[5 * 8 + 3] = TGL_PIXFMT(TGL_IDX(TGL_GREEN, TGL_BOLD));
+	tex_colors[5 * 8 + 6] = TGL_PIXFMT(TGL_IDX(TGL_RED, TGL_BOLD | TGL_UNDERLINE));
+	TGLTexture *const tex = tgl_texture_create(8, 8, tex_chars, tex_colors);
+	assert(tex);
+	tgl_texture(tgl, tex);
 
 	const float dn = 0.02F;
 	float n = 0;
@@ -459,11 +382,10 @@ static void demo_texture(const unsigned res_x, const unsigned res_y, const unsig
 		tgl_mulmat((const TGLVec4 *)camera, (const TGLVec4 *)transform,
 			vertex_shader_data.mat);
 
-		unsigned i;
 		for (i = 0; i < 12; i++) {
 			// Draw to framebuffer
 			tgl_triangle_3d(tgl, trigs[i], uvs[i % 2], true, &tgl_vertex_shader_simple,
-				&vertex_shader_data, &tgl_pixel_shader_texture, &tex);
+				&vertex_shader_data, NULL, NULL);
 		}
 
 		assert(!tgl_flush(tgl));
@@ -474,6 +396,7 @@ static void demo_texture(const unsigned res_x, const unsigned res_y, const unsig
 		sleep_ms(frametime_ms);
 	}
 
+	tgl_texture_delete(tex);
 	tgl_delete(tgl);
 }
 